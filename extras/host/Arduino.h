@@ -0,0 +1,73 @@
+/*
+  Arduino.h - minimal Arduino core for the host build of the z21 library
+  only what z21.cpp needs, see CMakeLists.txt
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef unsigned int word;
+
+static inline uint16_t makeWord(uint8_t h, uint8_t l) { return (h << 8) | l; }
+#define word(...) makeWord(__VA_ARGS__)
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+//like the ESP8266 core 2.5 and newer, so min(byte, int) fails here too
+using std::min;
+using std::max;
+
+//binary constants used by the library (binary.h)
+#define B11 3
+#define B111010 58
+#define B111011 59
+#define B00111111 63
+#define B00000000 0
+#define B00000001 1
+#define B00000010 2
+#define B00000100 4
+#define B00001000 8
+#define B00010000 16
+#define B00100000 32
+#define B01000000 64
+#define B10000000 128
+
+//no flash on the host
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(addr))
+#define memcpy_P memcpy
+
+//time since start, 32 bit like on the board, see arduino_stub.cpp
+unsigned long millis(void);
+unsigned long micros(void);
+
+//Serial for SERIALDEBUG, print to stdout
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+class HardwareSerial
+{
+  public:
+	void print(const char *s) { fputs(s, stdout); }
+	void print(long n, int base = DEC);
+	void println(const char *s) { print(s); println(); }
+	void println(long n, int base = DEC) { print(n, base); println(); }
+	void println() { fputc('\n', stdout); }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,29 @@
+/*
+  EEPROM.h - EEPROM in memory for the host build of the z21 library
+*/
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <Arduino.h>
+
+#ifndef EEPROM_SIZE
+#define EEPROM_SIZE 512
+#endif
+
+class EEPROMClass
+{
+  public:
+	EEPROMClass() { memset(data, 0xFF, sizeof(data)); }	//like an erased EEPROM
+	uint8_t read(int address) { return data[address]; }
+	void write(int address, uint8_t value) { data[address] = value; }
+	void update(int address, uint8_t value) { data[address] = value; }
+	uint16_t length() { return EEPROM_SIZE; }
+
+  private:
+	uint8_t data[EEPROM_SIZE];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
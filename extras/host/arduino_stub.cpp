@@ -0,0 +1,44 @@
+/*
+  arduino_stub.cpp - time, Serial and EEPROM of the host build
+*/
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <chrono>
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+//32 bit like on the board, unsigned long has 64 bit on the host
+unsigned long millis(void)
+{
+	return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long micros(void)
+{
+	return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void HardwareSerial::print(long n, int base)
+{
+	if (base == HEX)
+		printf("%lX", n);
+	else if (base == BIN)
+	{
+		if (n == 0)
+			fputc('0', stdout);
+		bool out = false;
+		for (int i = 31; i >= 0; i--)
+		{
+			if ((n >> i) & 0x01)
+				out = true;
+			if (out)
+				fputc(((n >> i) & 0x01) ? '1' : '0', stdout);
+		}
+	}
+	else
+		printf("%ld", n);
+}
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
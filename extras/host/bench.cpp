@@ -0,0 +1,182 @@
+/*
+  bench.cpp - micro benchmark of the z21 library on the host
+
+  - time of receive() for each message type
+  - time to send one broadcast to 1..N clients (fan-out)
+  - client timeout over the overflow of the 32 bit millis(), exit code 1 when it fails
+
+  z21_bench [iterations]
+*/
+
+#include <z21.h>
+#include <z21header.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned long simTime = 0;	//simulated time, no client runs out
+static unsigned long txFrames = 0;
+static unsigned long txBytes = 0;
+static unsigned long txClient[256];	//frames per client
+
+static unsigned long simClock(void)
+{
+	return simTime;
+}
+
+bool notifyz21EthSendData(uint8_t client, const uint8_t *, size_t length)
+{
+	txClient[client]++;
+	txFrames++;
+	txBytes += length;
+	return true;
+}
+
+struct BenchMessage {
+	const char *name;
+	uint8_t data[16];	//without length and XOR
+	uint8_t len;
+	bool withXOR;
+};
+
+//LAN messages without the length, X-Bus messages get their XOR byte
+static const BenchMessage messages[] = {
+	{"LAN_GET_SERIAL_NUMBER", {0x10, 0x00}, 2, false},
+	{"LAN_X_GET_VERSION", {0x40, 0x00, 0x21, 0x21}, 4, true},
+	{"LAN_X_GET_STATUS", {0x40, 0x00, 0x21, 0x24}, 4, true},
+	{"LAN_X_SET_TRACK_POWER_ON", {0x40, 0x00, 0x21, 0x81}, 4, true},
+	{"LAN_X_GET_LOCO_INFO", {0x40, 0x00, 0xE3, 0xF0, 0x00, 0x03}, 6, true},
+	{"LAN_X_SET_LOCO_DRIVE", {0x40, 0x00, 0xE4, 0x13, 0x00, 0x03, 0x20}, 7, true},
+	{"LAN_X_SET_LOCO_FUNCTION", {0x40, 0x00, 0xE4, 0xF8, 0x00, 0x03, 0x85}, 7, true},
+	{"LAN_X_SET_TURNOUT", {0x40, 0x00, 0x53, 0x00, 0x05, 0x09}, 6, true},
+	{"LAN_X_GET_TURNOUT_INFO", {0x40, 0x00, 0x43, 0x00, 0x05}, 5, true},
+	{"LAN_SET_BROADCASTFLAGS", {0x50, 0x00, 0x03, 0x00, 0x00, 0x00}, 6, false},
+	{"LAN_GET_BROADCASTFLAGS", {0x51, 0x00}, 2, false},
+	{"LAN_RMBUS_GETDATA", {0x81, 0x00, 0x00}, 3, false},
+	{"LAN_SYSTEMSTATE_GETDATA", {0x85, 0x00}, 2, false},
+	{"LAN_LOCONET_FROM_LAN", {0xA2, 0x00, 0xB2, 0x01, 0x10, 0x5C}, 6, false},
+	{"unknown LAN header", {0x99, 0x00}, 2, false},
+	{"wrong XOR", {0x40, 0x00, 0x21, 0x21, 0x55}, 5, false}, //XOR 0x00 would be right
+};
+
+//build the frame, return the length
+static uint8_t buildFrame(const BenchMessage &m, uint8_t *frame)
+{
+	uint8_t len = 2 + m.len + m.withXOR;
+	frame[0] = len;
+	frame[1] = 0;
+	memcpy(&frame[2], m.data, m.len);
+	if (m.withXOR)
+	{
+		uint8_t XOR = 0;
+		for (uint8_t i = 2; i < m.len; i++)
+			XOR ^= m.data[i];
+		frame[len - 1] = XOR;
+	}
+	return len;
+}
+
+static double nsSince(std::chrono::steady_clock::time_point start, unsigned long n)
+{
+	std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+	return d.count() / n;
+}
+
+static void benchReceive(unsigned long iterations)
+{
+	printf("receive()                      ns/op   frames/op   bytes/op\n");
+	for (size_t m = 0; m < sizeof(messages) / sizeof(messages[0]); m++)
+	{
+		z21Class z21;
+		z21.setClock(simClock);
+		uint8_t frame[24];
+		uint8_t len = buildFrame(messages[m], frame);
+		z21.receive(1, frame, len); //client is known
+		txFrames = 0;
+		txBytes = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (unsigned long i = 0; i < iterations; i++)
+			z21.receive(1, frame, len);
+		double ns = nsSince(start, iterations);
+		printf("%-26s %9.1f %11.2f %10.1f\n", messages[m].name, ns, (double)txFrames / iterations, (double)txBytes / iterations);
+	}
+}
+
+static void benchFanOut(unsigned long iterations)
+{
+	static const uint8_t clientCount[] = {1, 2, 4, 8, 16, z21clientMAX};
+	printf("\nfan-out       clients      ns/op   frames/op   ns/frame\n");
+	for (size_t c = 0; c < sizeof(clientCount) / sizeof(clientCount[0]); c++)
+	{
+		z21Class z21;
+		z21.setClock(simClock);
+		//all clients want S88 data and LAN_X_LOCO_INFO of loco 3
+		uint8_t flags[] = {0x08, 0x00, 0x50, 0x00, Z21bcAll | Z21bcRBus, 0x00, 0x00, 0x00};
+		uint8_t subscribe[] = {0x09, 0x00, 0x40, 0x00, 0xE3, 0xF0, 0x00, 0x03, 0xE3 ^ 0xF0 ^ 0x03};
+		for (uint8_t n = 1; n <= clientCount[c]; n++)
+		{
+			z21.receive(n, flags, sizeof(flags));
+			z21.receive(n, subscribe, sizeof(subscribe));
+		}
+
+		byte s88[10] = {0};
+		txFrames = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (unsigned long i = 0; i < iterations; i++)
+		{
+			s88[0] = i; //one changed group
+			z21.setS88Data(s88, 10);
+		}
+		double ns = nsSince(start, iterations);
+		printf("S88 group   %9d %10.1f %11.2f %10.1f\n", clientCount[c], ns, (double)txFrames / iterations, txFrames ? ns * iterations / txFrames : 0.0);
+
+		txFrames = 0;
+		start = std::chrono::steady_clock::now();
+		for (unsigned long i = 0; i < iterations; i++)
+			z21.setLocoStateFull(3, DCCSTEP128, i & 0x7F, 0, 0, 0, 0, true);
+		ns = nsSince(start, iterations);
+		printf("LOCO_INFO   %9d %10.1f %11.2f %10.1f\n", clientCount[c], ns, (double)txFrames / iterations, txFrames ? ns * iterations / txFrames : 0.0);
+	}
+}
+
+//millis() runs over after 49 days: a client must stay until its timeout, not longer
+static bool benchClockWrap()
+{
+	z21Class z21;
+	z21.setClock(simClock);
+	simTime = 0xFFFFFFFFUL - z21IPinterval / 2;
+	uint8_t flags[] = {0x08, 0x00, 0x50, 0x00, Z21bcRBus, 0x00, 0x00, 0x00};
+	z21.receive(1, flags, sizeof(flags));
+	z21.receive(2, flags, sizeof(flags));
+	byte s88[10] = {0};
+	simTime = (uint32_t)(simTime + z21IPinterval); //over the overflow
+	z21.tick();
+	memset(txClient, 0, sizeof(txClient));
+	z21.setS88DataFull(s88, 10);
+	z21.flush();
+	bool ok = txClient[1] == 1 && txClient[2] == 1;
+	for (int i = 0; i <= z21ActTimeIP; i++)
+	{ //client 2 is silent and runs out
+		simTime = (uint32_t)(simTime + z21IPinterval);
+		z21.receive(1, flags, sizeof(flags));
+	}
+	memset(txClient, 0, sizeof(txClient));
+	z21.setS88DataFull(s88, 10);
+	z21.flush();
+	ok = ok && txClient[1] == 1 && txClient[2] == 0;
+	printf("\nclock overflow              %s\n", ok ? "ok" : "FAILED");
+	simTime = 0;
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long iterations = 100000;
+	if (argc > 1)
+		iterations = strtoul(argv[1], NULL, 10);
+	if (iterations == 0)
+		iterations = 1;
+	benchReceive(iterations);
+	benchFanOut(iterations);
+	return benchClockWrap() ? 0 : 1;
+}
@@ -0,0 +1,369 @@
+/*
+  loadgen.cpp - club layout load for the z21 library on the host
+
+  N throttles drive their loco and switch functions, poll the system state
+  and the S88 data, change their broadcast flags and now and then set a
+  whole route of turnouts. At the same time the command station side
+  reports S88, LocoNet and the loco state back like a sketch would do
+  (station.cpp).
+  The time is simulated, so a session runs as fast as the CPU allows.
+
+  z21_loadgen [clients] [seconds] [seed] [-v] [-w file]
+    -v       bytes of each client
+    -w file  write a capture for z21_replay (build with -Dz21Capture)
+  With -Dz21Stats also the counters and time histograms of the library.
+*/
+
+#include <z21.h>
+#include <z21header.h>
+#include "station.h"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static z21Class z21;
+static unsigned long simTime = 0;	//simulated milliseconds
+
+static unsigned long simClock(void)
+{
+	return simTime;
+}
+
+//--------------------------------------------------------------------------------------------
+//deterministic random numbers (xorshift32)
+static uint32_t rnd = 1;
+
+static uint32_t random32(void)
+{
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	return rnd;
+}
+
+static unsigned long randomRange(unsigned long from, unsigned long to)
+{
+	return from + random32() % (to - from + 1);
+}
+
+//--------------------------------------------------------------------------------------------
+//output of the library
+static unsigned long txBytes[256];	//per client, 0 = all clients
+static unsigned long txDatagrams[256];
+
+bool notifyz21EthSendData(uint8_t client, const uint8_t *, size_t length)
+{
+	txBytes[client] += length;
+	txDatagrams[client]++;
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------
+//capture for z21_replay
+static FILE *captureFile = NULL;
+
+#if defined(z21Capture)
+void notifyz21Capture(const TypeSpan *span, uint8_t count)
+{
+	if (captureFile == NULL)
+		return;
+	for (uint8_t s = 0; s < count; s++)
+		fwrite(span[s].data, 1, span[s].length, captureFile);
+}
+#endif
+
+//--------------------------------------------------------------------------------------------
+//handling time of the library calls
+static std::vector<uint32_t> rxTime;	//ns per received datagram
+static std::vector<uint32_t> fbTime;	//ns per feedback call
+static unsigned long rxMessages = 0;
+static double busyNs = 0;
+
+typedef std::chrono::steady_clock Clock;
+
+static uint32_t elapsed(Clock::time_point start)
+{
+	double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	busyNs += ns;
+	return ns;
+}
+
+//add a message, X-Bus messages (header 0x40) get their XOR byte
+static void addMessage(std::vector<uint8_t> &datagram, std::initializer_list<uint8_t> data)
+{
+	bool withXOR = *data.begin() == 0x40;
+	uint8_t len = 2 + data.size() + withXOR;
+	uint8_t XOR = 0;
+	datagram.push_back(len);
+	datagram.push_back(0);
+	for (std::initializer_list<uint8_t>::const_iterator i = data.begin(); i != data.end(); i++)
+	{
+		if (i - data.begin() >= 2)
+			XOR ^= *i;
+		datagram.push_back(*i);
+	}
+	if (withXOR)
+		datagram.push_back(XOR);
+	rxMessages++;
+}
+
+static void send(uint8_t client, std::vector<uint8_t> &datagram)
+{
+	Clock::time_point start = Clock::now();
+	z21.receive(client, datagram.data(), datagram.size());
+	rxTime.push_back(elapsed(start));
+	datagram.clear();
+}
+
+//--------------------------------------------------------------------------------------------
+//one throttle
+struct Throttle {
+	uint16_t loco;
+	byte speed;
+	bool up;
+	unsigned long nextDrive;
+	unsigned long nextFkt;
+	unsigned long nextState;
+	unsigned long nextRBus;
+	unsigned long nextFlags;
+	bool allFlags;
+};
+
+static void throttleStep(uint8_t client, Throttle &t)
+{
+	std::vector<uint8_t> d;
+	if (simTime >= t.nextDrive)
+	{ //slide the speed up and down
+		if (t.up && ++t.speed >= 126)
+			t.up = false;
+		else if (!t.up && --t.speed <= 2)
+			t.up = true;
+		addMessage(d, {0x40, 0x00, LAN_X_SET_LOCO, 0x13, (uint8_t)(t.loco >> 8), (uint8_t)t.loco, (uint8_t)(0x80 | t.speed)});
+		send(client, d);
+		t.nextDrive = simTime + randomRange(80, 120);
+	}
+	if (simTime >= t.nextFkt)
+	{ //toggle F0-F4
+		addMessage(d, {0x40, 0x00, LAN_X_SET_LOCO, LAN_X_SET_LOCO_FUNCTION, (uint8_t)(t.loco >> 8), (uint8_t)t.loco, (uint8_t)(0x80 | randomRange(0, 4))});
+		send(client, d);
+		t.nextFkt = simTime + randomRange(1500, 2500);
+	}
+	if (simTime >= t.nextState)
+	{
+		addMessage(d, {0x85, 0x00}); //LAN_SYSTEMSTATE_GETDATA
+		send(client, d);
+		t.nextState = simTime + 1000;
+	}
+	if (simTime >= t.nextRBus)
+	{
+		addMessage(d, {0x81, 0x00, (uint8_t)randomRange(0, 1)}); //LAN_RMBUS_GETDATA
+		send(client, d);
+		t.nextRBus = simTime + randomRange(4000, 6000);
+	}
+	if (simTime >= t.nextFlags)
+	{ //with or without LocoNet and system state
+		t.allFlags = !t.allFlags;
+		uint32_t flags = Z21bcAll | Z21bcRBus;
+		if (t.allFlags)
+			flags |= Z21bcSystemInfo | Z21bcLocoNet;
+		addMessage(d, {0x50, 0x00, (uint8_t)flags, (uint8_t)(flags >> 8), (uint8_t)(flags >> 16), (uint8_t)(flags >> 24)});
+		send(client, d);
+		t.nextFlags = simTime + randomRange(20000, 40000);
+	}
+}
+
+//a route: many turnouts in one datagram, activate and deactivate
+static void turnoutStorm(uint8_t client)
+{
+	std::vector<uint8_t> d;
+	uint16_t first = randomRange(0, 200);
+	for (uint16_t adr = first; adr < first + 16; adr++)
+	{
+		uint8_t out = randomRange(0, 1);
+		addMessage(d, {0x40, 0x00, LAN_X_SET_TURNOUT, (uint8_t)(adr >> 8), (uint8_t)adr, (uint8_t)(0x88 | out)});
+		addMessage(d, {0x40, 0x00, LAN_X_SET_TURNOUT, (uint8_t)(adr >> 8), (uint8_t)adr, (uint8_t)(0x80 | out)});
+		if (d.size() > 1400)
+			send(client, d);
+	}
+	if (!d.empty())
+		send(client, d);
+}
+
+//--------------------------------------------------------------------------------------------
+static uint32_t percentile(std::vector<uint32_t> &v, int p)
+{
+	if (v.empty())
+		return 0;
+	size_t n = (v.size() - 1) * p / 100;
+	std::nth_element(v.begin(), v.begin() + n, v.end());
+	return v[n];
+}
+
+int main(int argc, char *argv[])
+{
+	int clients = 30;
+	unsigned long seconds = 300;
+	bool verbose = false;
+	int pos = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-v") == 0)
+			verbose = true;
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+		{
+#if defined(z21Capture)
+			captureFile = fopen(argv[++i], "wb");
+			if (captureFile == NULL)
+			{
+				printf("can't write %s\n", argv[i]);
+				return 1;
+			}
+#else
+			printf("-w needs a build with -Dz21Capture\n");
+			return 1;
+#endif
+		}
+		else
+		{
+			switch (pos++)
+			{
+			case 0:
+				clients = atoi(argv[i]);
+				break;
+			case 1:
+				seconds = strtoul(argv[i], NULL, 10);
+				break;
+			case 2:
+				rnd = strtoul(argv[i], NULL, 10) | 1;
+				break;
+			}
+		}
+	}
+	if (clients < 1 || clients > 254)
+		clients = 30;
+	if (seconds == 0)
+		seconds = 1;
+
+	z21.setClock(simClock);
+	stationBegin(&z21);
+	z21.setPower(csNormal);
+
+	std::vector<Throttle> throttles(clients + 1);
+	std::vector<uint8_t> d;
+	for (int c = 1; c <= clients; c++)
+	{ //log on: broadcast flags and the own loco
+		Throttle &t = throttles[c];
+		t.loco = 3 + c;
+		t.speed = 2;
+		t.up = true;
+		t.nextDrive = randomRange(0, 100);
+		t.nextFkt = randomRange(0, 2000);
+		t.nextState = randomRange(0, 1000);
+		t.nextRBus = randomRange(0, 5000);
+		t.nextFlags = randomRange(0, 30000);
+		t.allFlags = true;
+		addMessage(d, {0x50, 0x00, Z21bcAll | Z21bcRBus, 0x01, 0x00, 0x01}); //+ SystemInfo, LocoNet
+		addMessage(d, {0x40, 0x00, LAN_X_GET_LOCO_INFO, 0xF0, (uint8_t)(t.loco >> 8), (uint8_t)t.loco});
+		send(c, d);
+	}
+
+	byte s88[20] = {0};
+	unsigned long nextStorm = 5000;
+	unsigned long nextS88 = 0;
+#if z21LocoNet
+	unsigned long nextLN = 0;
+#endif
+	unsigned long nextSystem = 0;
+	unsigned long end = seconds * 1000;
+	for (simTime = 0; simTime < end; simTime++)
+	{
+		for (int c = 1; c <= clients; c++)
+			throttleStep(c, throttles[c]);
+		if (simTime >= nextStorm)
+		{
+			turnoutStorm(randomRange(1, clients));
+			nextStorm = simTime + randomRange(15000, 25000);
+		}
+		Clock::time_point start = Clock::now();
+		if (simTime >= nextS88)
+		{ //a train runs over the sensors
+			s88[randomRange(0, sizeof(s88) - 1)] ^= 1 << randomRange(0, 7);
+			z21.setS88Data(s88, sizeof(s88));
+			fbTime.push_back(elapsed(start));
+			nextS88 = simTime + 50;
+		}
+#if z21LocoNet
+		if (simTime >= nextLN)
+		{ //OPC_INPUT_REP
+			byte ln[4] = {0xB2, (byte)randomRange(0, 0x7F), (byte)randomRange(0x40, 0x7F), 0};
+			ln[3] = 0xFF ^ ln[0] ^ ln[1] ^ ln[2];
+			start = Clock::now();
+			z21.setLNMessage(ln, sizeof(ln), Z21bcLocoNet_s, false);
+			fbTime.push_back(elapsed(start));
+			nextLN = simTime + 100;
+		}
+#endif
+		if (simTime >= nextSystem)
+		{
+			start = Clock::now();
+			stationSystemInfo(0);
+			fbTime.push_back(elapsed(start));
+			nextSystem = simTime + 1000;
+		}
+		start = Clock::now();
+		z21.tick();
+		busyNs += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	}
+
+	//--------------------------------------------------------------------------------------------
+	unsigned long sum = 0;
+	unsigned long minBytes = ~0UL;
+	unsigned long maxBytes = 0;
+	for (int c = 1; c <= clients; c++)
+	{
+		sum += txBytes[c];
+		minBytes = std::min(minBytes, txBytes[c]);
+		maxBytes = std::max(maxBytes, txBytes[c]);
+	}
+	printf("clients %d, %lu s simulated\n", clients, seconds);
+	printf("received      %lu messages in %zu datagrams, %.1f messages/s simulated\n", rxMessages, rxTime.size(), (double)rxMessages / seconds);
+	printf("library busy  %.1f ms, %.0f messages/s possible\n", busyNs / 1e6, rxMessages / (busyNs / 1e9));
+	printf("receive()     p50 %u ns, p99 %u ns per datagram\n", percentile(rxTime, 50), percentile(rxTime, 99));
+	printf("feedback      p50 %u ns, p99 %u ns per call\n", percentile(fbTime, 50), percentile(fbTime, 99));
+	printf("sent to all   %lu Byte in %lu datagrams\n", txBytes[0], txDatagrams[0]);
+	printf("sent per client  min %lu, avg %lu, max %lu Byte (%.1f Byte/s avg)\n", minBytes, sum / clients, maxBytes, (double)sum / clients / seconds);
+	if (verbose)
+	{
+		for (int c = 1; c <= clients; c++)
+			printf("  client %3d  %8lu Byte  %6lu datagrams\n", c, txBytes[c], txDatagrams[c]);
+	}
+	printf("dropped %lu, superseded %lu, malformed %lu\n", z21.getTxDropped(), z21.getTxSuperseded(), z21.getRxMalformed());
+#if defined(z21Stats)
+	TypeStats stats;
+	z21.getStats(&stats);
+	printf("logon %lu, logoff %lu, full %lu, active %d\n", stats.logon, stats.logoff, stats.full, stats.clients);
+	printf("receive() us  ");
+	for (int b = 0; b < z21StatsBins; b++)
+		printf(" %lu", stats.receiveTime[b]);
+	printf("\nsend us       ");
+	for (int b = 0; b < z21StatsBins; b++)
+		printf(" %lu", stats.sendTime[b]);
+	printf("\nfan-out       ");
+	for (int b = 0; b < z21StatsFanOut; b++)
+		printf(" %lu", stats.fanOut[b]);
+	printf("\n");
+	for (int m = 0; m < z21StatsMessages; m++)
+	{
+		uint16_t header;
+		byte xheader, db0;
+		if (stats.rxMessage[m] != 0 && z21.getStatsMessage(m, &header, &xheader, &db0))
+			printf("  0x%02X 0x%02X 0x%02X  %lu messages\n", header, xheader, db0, stats.rxMessage[m]);
+	}
+#endif
+	if (captureFile != NULL)
+		fclose(captureFile);
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+  replay.cpp - replay a capture of the z21 library (z21Capture) on the host
+
+  Every received datagram of the capture goes into one z21Class at the
+  time of the record, the state of the earlier datagrams (clients, BC flags,
+  loco states) stays as on the board. The frames it sends are compared with the frames
+  that were recorded as answers of this datagram (z21CaptureTX).
+  Frames the sketch did send (z21CaptureTXAPI) are not compared, only the
+  track power and the S88 state of them are set again. The callbacks are answered by the
+  command station of station.cpp; where the real sketch answers in
+  another way, this shows up as a difference.
+
+  z21_replay capture.bin [-v]	(-v: print all differences)
+*/
+
+#include <z21.h>
+#include <z21header.h>
+#include "station.h"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+struct Record {
+	unsigned long time;
+	uint8_t client;
+	uint8_t type;
+	std::vector<uint8_t> data;
+};
+
+struct Frame {
+	uint8_t client;
+	std::vector<uint8_t> data;
+};
+
+static unsigned long simTime = 0;
+static std::vector<Frame> sent;	//frames of the current datagram
+
+static unsigned long simClock(void)
+{
+	return simTime;
+}
+
+//split into frames, with z21TxBuffer one call can hold more than one
+bool notifyz21EthSendData(uint8_t client, const uint8_t *data, size_t length)
+{
+	size_t i = 0;
+	while (i + 4 <= length)
+	{
+		uint16_t len = word(data[i + 1], data[i]);
+		if (len < 4 || i + len > length)
+			break;
+		Frame f;
+		f.client = client;
+		f.data.assign(data + i, data + i + len);
+		sent.push_back(f);
+		i += len;
+	}
+	return true;
+}
+
+static bool byClient(const Frame &a, const Frame &b)
+{
+	return a.client < b.client;
+}
+
+static bool readCapture(const char *name, std::vector<Record> &records)
+{
+	FILE *file = fopen(name, "rb");
+	if (file == NULL)
+		return false;
+	uint8_t head[z21CaptureHeader];
+	while (fread(head, 1, sizeof(head), file) == sizeof(head))
+	{
+		Record r;
+		r.time = head[0] | ((unsigned long)head[1] << 8) | ((unsigned long)head[2] << 16) | ((unsigned long)head[3] << 24);
+		r.client = head[4];
+		r.type = head[5];
+		r.data.resize(word(head[7], head[6]));
+		if (fread(r.data.data(), 1, r.data.size(), file) != r.data.size())
+			break; //capture was cut
+		records.push_back(r);
+	}
+	fclose(file);
+	return true;
+}
+
+static void printFrame(const char *what, uint8_t client, const std::vector<uint8_t> &data)
+{
+	printf("  %s c%d:", what, client);
+	for (size_t i = 0; i < data.size(); i++)
+		printf(" %02x", data[i]);
+	printf("\n");
+}
+
+static byte s88[z21S88MAX];
+static byte s88Modules = 0;
+
+//the sketch did change the track power or the S88 state
+static void applySketchFrame(z21Class &z21, const Record &r)
+{
+	const std::vector<uint8_t> &d = r.data;
+	if (d.size() == 15 && word(d[3], d[2]) == LAN_RMBUS_DATACHANGED)
+	{ //group with 10 modules
+		if (d[4] * 10 + 10 > z21S88MAX)
+			return;
+		memcpy(&s88[d[4] * 10], &d[5], 10);
+		s88Modules = std::max<int>(s88Modules, d[4] * 10 + 10);
+		z21.setS88Data(s88, s88Modules);
+		z21.flush();
+		sent.clear(); //frames of the sketch
+		return;
+	}
+	if (d.size() < 7 || word(d[3], d[2]) != LAN_X_Header)
+		return;
+	byte state = 0xFF;
+	if (d[4] == LAN_X_BC_TRACK_POWER)
+	{
+		switch (d[5])
+		{
+		case 0x00: state = csTrackVoltageOff; break;
+		case 0x01: state = csNormal; break;
+		case 0x02: state = csServiceMode; break;
+		case 0x08: state = csShortCircuit; break;
+		}
+	}
+	else if (d[4] == LAN_X_BC_STOPPED)
+		state = csEmergencyStop;
+	if (state != 0xFF && state != z21.getPower())
+	{
+		z21.setPower(state);
+		z21.flush();
+		sent.clear(); //frames of the sketch
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		printf("z21_replay capture.bin [-v]\n");
+		return 2;
+	}
+	bool verbose = argc > 2 && strcmp(argv[2], "-v") == 0;
+	std::vector<Record> records;
+	if (!readCapture(argv[1], records))
+	{
+		printf("can't read %s\n", argv[1]);
+		return 2;
+	}
+
+	z21Class z21;
+	z21.setClock(simClock);
+	stationBegin(&z21);
+	unsigned long datagrams = 0;
+	unsigned long expected = 0;
+	unsigned long produced = 0;
+	unsigned long notCompared = 0;
+	unsigned long different = 0;
+	double busyNs = 0;
+	for (size_t n = 0; n < records.size(); n++)
+	{
+		if (records[n].type == z21CaptureTXAPI)
+		{
+			notCompared++;
+			applySketchFrame(z21, records[n]);
+		}
+		if (records[n].type != z21CaptureRX)
+			continue;
+		//the recorded answers follow the datagram
+		std::vector<Frame> answers;
+		for (size_t a = n + 1; a < records.size() && records[a].type != z21CaptureRX; a++)
+		{
+			if (records[a].type == z21CaptureTX)
+			{
+				Frame f;
+				f.client = records[a].client;
+				f.data = records[a].data;
+				answers.push_back(f);
+			}
+		}
+		simTime = records[n].time;
+		sent.clear();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		z21.receive(records[n].client, records[n].data.data(), records[n].data.size());
+		busyNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		datagrams++;
+		expected += answers.size();
+		produced += sent.size();
+
+		//the order between the clients depends on z21TxBuffer, only compare it for each client
+		std::stable_sort(answers.begin(), answers.end(), byClient);
+		std::stable_sort(sent.begin(), sent.end(), byClient);
+		bool same = answers.size() == sent.size();
+		for (size_t i = 0; same && i < sent.size(); i++)
+			same = answers[i].client == sent[i].client && answers[i].data == sent[i].data;
+		if (same)
+			continue;
+		different++;
+		if (different <= 10 || verbose)
+		{
+			printf("record %zu, %lu ms, client %d: different answer\n", n, records[n].time, records[n].client);
+			printFrame("received", records[n].client, records[n].data);
+			for (size_t i = 0; i < answers.size(); i++)
+				printFrame("recorded", answers[i].client, answers[i].data);
+			for (size_t i = 0; i < sent.size(); i++)
+				printFrame("replay  ", sent[i].client, sent[i].data);
+		}
+	}
+	printf("%lu datagrams, %lu frames recorded, %lu frames replayed, %lu frames of the sketch not compared\n", datagrams, expected, produced, notCompared);
+	printf("%lu datagrams with a different answer\n", different);
+	printf("receive() %.1f ns per datagram\n", datagrams ? busyNs / datagrams : 0.0);
+	return different ? 1 : 0;
+}
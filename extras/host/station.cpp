@@ -0,0 +1,71 @@
+/*
+  station.cpp - command station for the host tools, see station.h
+*/
+
+#include <z21.h>
+#include "station.h"
+
+static z21Class *station = NULL;
+
+struct LocoSim {
+	byte speed;
+	byte F0;
+};
+
+static LocoSim locos[256];
+static bool turnouts[1024];
+
+void stationBegin(z21Class *z21)
+{
+	station = z21;
+	memset(locos, 0, sizeof(locos));
+	memset(turnouts, 0, sizeof(turnouts));
+}
+
+void stationSystemInfo(byte client)
+{
+	if (station != NULL)
+		station->sendSystemInfo(client, 850, 16200, 35); //mA, mV, °C
+}
+
+//--------------------------------------------------------------------------------------------
+void notifyz21LocoSpeed(uint16_t Adr, uint8_t speed, uint8_t)
+{
+	locos[Adr & 0xFF].speed = speed;
+	if (station != NULL)
+		station->setLocoStateFull(Adr, DCCSTEP128, speed, locos[Adr & 0xFF].F0, 0, 0, 0, true);
+}
+
+void notifyz21LocoFkt(uint16_t Adr, uint8_t type, uint8_t fkt)
+{
+	if (fkt <= 4 && type <= 2) //2 = toggle, the library does not know the loco yet
+		bitWrite(locos[Adr & 0xFF].F0, fkt == 0 ? 4 : fkt - 1, type == 2 ? !bitRead(locos[Adr & 0xFF].F0, fkt == 0 ? 4 : fkt - 1) : type);
+	if (station != NULL)
+		station->setLocoStateFull(Adr, DCCSTEP128, locos[Adr & 0xFF].speed, locos[Adr & 0xFF].F0, 0, 0, 0, true);
+}
+
+void notifyz21getLocoState(uint16_t Adr, bool bc)
+{
+	if (station != NULL)
+		station->setLocoStateFull(Adr, DCCSTEP128, locos[Adr & 0xFF].speed, locos[Adr & 0xFF].F0, 0, 0, 0, bc);
+}
+
+void notifyz21Accessory(uint16_t Adr, bool state, bool active)
+{
+	if (active)
+	{
+		turnouts[Adr & 0x3FF] = state;
+		if (station != NULL)
+			station->setTrntInfo(Adr, state);
+	}
+}
+
+uint8_t notifyz21AccessoryInfo(uint16_t Adr)
+{
+	return turnouts[Adr & 0x3FF];
+}
+
+void notifyz21getSystemInfo(uint8_t client)
+{
+	stationSystemInfo(client);
+}
@@ -0,0 +1,17 @@
+/*
+  station.h - command station for the host tools
+  answers the callbacks of the z21 library like a simple sketch:
+  loco state, turnouts and system state
+*/
+
+#ifndef z21station_h
+#define z21station_h
+
+#include <Arduino.h>
+
+class z21Class;
+
+void stationBegin(z21Class *z21);	//answer the callbacks for this instance
+void stationSystemInfo(byte client);	//LAN_SYSTEMSTATE_DATACHANGED with the simulated values
+
+#endif
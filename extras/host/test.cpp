@@ -0,0 +1,413 @@
+/*
+  test.cpp - behaviour tests of the z21 library on the host
+
+  Each test feeds LAN messages into a fresh z21Class and checks the frames
+  it sends, the callbacks and the counters. CMakeLists.txt builds this file
+  once for each set of options (z21TxBuffer, z21TxRetry, z21SpeedQueue),
+  tests that need an option are only built with it.
+
+  z21_test	(exit code 1 when a test fails)
+*/
+
+#include <z21.h>
+#include <z21header.h>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+static int failed = 0;
+
+#define CHECK(cond) check((cond), #cond, __func__, __LINE__)
+
+static void check(bool ok, const char *cond, const char *test, int line)
+{
+	if (ok)
+		return;
+	printf("%s:%d: %s failed\n", test, line, cond);
+	failed++;
+}
+
+//--------------------------------------------------------------------------------------------
+//transport: every frame that was send, in the order of the datagrams
+struct Frame {
+	uint8_t client;	//0 = all
+	std::vector<uint8_t> data;
+};
+
+static std::vector<Frame> sent;
+static unsigned long datagrams = 0;
+static bool busy = false;	//transport can't send
+
+bool notifyz21EthSendData(uint8_t client, const uint8_t *data, size_t length)
+{
+	if (busy)
+		return false;
+	datagrams++;
+	size_t i = 0;
+	while (i + 4 <= length)
+	{ //one datagram can hold more frames (z21TxBuffer)
+		size_t len = word(data[i + 1], data[i]);
+		if (len < 4 || i + len > length)
+			break;
+		Frame f = {client, std::vector<uint8_t>(&data[i], &data[i + len])};
+		sent.push_back(f);
+		i += len;
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------
+//sketch side
+static z21Class *station = NULL;
+static unsigned long locoStateAsked = 0;
+static uint16_t fktAdr;
+static uint8_t fktType;
+static uint8_t fktFkt;
+static unsigned long fktCalls = 0;
+
+void notifyz21getLocoState(uint16_t, bool)
+{
+	locoStateAsked++;
+}
+
+void notifyz21LocoFkt(uint16_t Adr, uint8_t type, uint8_t fkt)
+{
+	fktAdr = Adr;
+	fktType = type;
+	fktFkt = fkt;
+	fktCalls++;
+}
+
+void notifyz21RailPower(uint8_t State)
+{
+	if (station != NULL)
+		station->setPower(State);
+}
+
+//--------------------------------------------------------------------------------------------
+//helpers
+
+//X-Bus message with length, header and XOR
+static uint8_t xbus(uint8_t *frame, const uint8_t *x, uint8_t n)
+{
+	frame[0] = 5 + n;
+	frame[1] = 0x00;
+	frame[2] = LAN_X_Header;
+	frame[3] = 0x00;
+	uint8_t XOR = 0;
+	for (uint8_t i = 0; i < n; i++)
+	{
+		frame[4 + i] = x[i];
+		XOR ^= x[i];
+	}
+	frame[4 + n] = XOR;
+	return 5 + n;
+}
+
+static void receiveX(z21Class &z21, uint8_t client, const uint8_t *x, uint8_t n)
+{
+	uint8_t frame[32];
+	uint8_t len = xbus(frame, x, n);
+	z21.receive(client, frame, len);
+}
+
+static void logon(z21Class &z21, uint8_t client, unsigned long flags)
+{
+	uint8_t msg[] = {0x08, 0x00, LAN_SET_BROADCASTFLAGS, 0x00, (uint8_t)flags, (uint8_t)(flags >> 8), (uint8_t)(flags >> 16), (uint8_t)(flags >> 24)};
+	z21.receive(client, msg, sizeof(msg));
+}
+
+static void getLocoInfo(z21Class &z21, uint8_t client, uint16_t Adr)
+{
+	uint8_t x[] = {LAN_X_GET_LOCO_INFO, 0xF0, (uint8_t)((Adr >> 8) & 0x3F), (uint8_t)Adr};
+	receiveX(z21, client, x, sizeof(x));
+}
+
+static void setLocoFkt(z21Class &z21, uint8_t client, uint16_t Adr, uint8_t type, uint8_t fkt)
+{
+	uint8_t x[] = {LAN_X_SET_LOCO, LAN_X_SET_LOCO_FUNCTION, (uint8_t)((Adr >> 8) & 0x3F), (uint8_t)Adr, (uint8_t)((type << 6) | fkt)};
+	receiveX(z21, client, x, sizeof(x));
+}
+
+static void setLocoDrive(z21Class &z21, uint8_t client, uint16_t Adr, uint8_t speed)
+{
+	uint8_t x[] = {LAN_X_SET_LOCO, 0x13, (uint8_t)((Adr >> 8) & 0x3F), (uint8_t)Adr, speed};
+	receiveX(z21, client, x, sizeof(x));
+}
+
+static void setStop(z21Class &z21, uint8_t client)
+{
+	uint8_t x[] = {LAN_X_SET_STOP};
+	receiveX(z21, client, x, sizeof(x));
+}
+
+static void reset()
+{
+	sent.clear();
+	datagrams = 0;
+	busy = false;
+}
+
+//frames to a client (also the ones to all) with this LAN header and X-Header (0 = any)
+static int countFrames(uint8_t client, uint8_t header, uint8_t xheader)
+{
+	int n = 0;
+	for (size_t i = 0; i < sent.size(); i++)
+	{
+		const Frame &f = sent[i];
+		if ((f.client == client || f.client == 0) && f.data[2] == header && (xheader == 0 || f.data[4] == xheader))
+			n++;
+	}
+	return n;
+}
+
+//LAN_X_LOCO_INFO of this loco to the client
+static int countLocoInfo(uint8_t client, uint16_t Adr)
+{
+	int n = 0;
+	for (size_t i = 0; i < sent.size(); i++)
+	{
+		const Frame &f = sent[i];
+		if ((f.client == client || f.client == 0) && f.data[2] == LAN_X_Header && f.data[4] == LAN_X_LOCO_INFO && word(f.data[5] & 0x3F, f.data[6]) == Adr)
+			n++;
+	}
+	return n;
+}
+
+//position of the first frame with this LAN header and X-Header (0 = any), -1 = not send
+static int findFrame(uint8_t header, uint8_t xheader, uint8_t db0)
+{
+	for (size_t i = 0; i < sent.size(); i++)
+	{
+		const Frame &f = sent[i];
+		if (f.data[2] == header && (xheader == 0 || (f.data[4] == xheader && f.data[5] == db0)))
+			return i;
+	}
+	return -1;
+}
+
+//--------------------------------------------------------------------------------------------
+//all messages of a datagram are answered (user-001)
+static void testDatagram()
+{
+	z21Class z21;
+	logon(z21, 1, 0);
+	reset();
+	uint8_t datagram[] = {
+		0x04, 0x00, LAN_GET_SERIAL_NUMBER, 0x00,
+		0x07, 0x00, LAN_X_Header, 0x00, 0x21, 0x21, 0x00, //LAN_X_GET_VERSION
+		0x04, 0x00, LAN_GET_CODE, 0x00};
+	z21.receive(1, datagram, sizeof(datagram));
+	CHECK(countFrames(1, LAN_GET_SERIAL_NUMBER, 0) == 1);
+	CHECK(countFrames(1, LAN_X_Header, LAN_X_GET_VERSION) == 1);
+	CHECK(countFrames(1, LAN_GET_CODE, 0) == 1);
+#if defined(z21TxBuffer)
+	CHECK(datagrams == 1); //answers collected into one datagram (user-011)
+#endif
+}
+
+//wrong XOR and length are rejected before the dispatch (user-015)
+static void testMalformed()
+{
+	z21Class z21;
+	logon(z21, 1, 0);
+	reset();
+	uint8_t badXOR[] = {0x07, 0x00, LAN_X_Header, 0x00, 0x21, 0x21, 0x55};
+	z21.receive(1, badXOR, sizeof(badXOR));
+	CHECK(sent.empty());
+	CHECK(z21.getRxMalformed() == 1);
+	uint8_t badLen[] = {0x04, 0x00, LAN_GET_SERIAL_NUMBER, 0x00, 0x20, 0x00, LAN_GET_CODE, 0x00};
+	z21.receive(1, badLen, sizeof(badLen));
+	CHECK(countFrames(1, LAN_GET_SERIAL_NUMBER, 0) == 1); //the good message before
+	CHECK(countFrames(1, LAN_GET_CODE, 0) == 0);
+	CHECK(z21.getRxMalformed() == 2);
+}
+
+//a rejected stop does not start the stop latency (user-013)
+static void testStopLatency()
+{
+	z21Class z21;
+	logon(z21, 1, Z21bcAll);
+	uint8_t badStop[] = {0x06, 0x00, LAN_X_Header, 0x00, LAN_X_SET_STOP, 0x81};
+	z21.receive(1, badStop, sizeof(badStop));
+	unsigned long start = micros();
+	while (micros() - start < 2000)
+		; //the next stop frame comes later
+	z21.setPower(csShortCircuit);
+	CHECK(z21.getStopLatencyMax() == 0);
+	station = &z21; //the sketch answers the stop with setPower()
+	reset();
+	setStop(z21, 1);
+	CHECK(findFrame(LAN_X_Header, LAN_X_BC_STOPPED, 0x00) == 0);
+	station = NULL;
+}
+
+//only the changed S88 groups are send (user-010)
+static void testS88()
+{
+	z21Class z21;
+	logon(z21, 1, Z21bcRBus);
+	reset();
+	byte s88[20] = {0};
+	z21.setS88Data(s88, 20);
+	z21.flush();
+	CHECK(countFrames(1, LAN_RMBUS_DATACHANGED, 0) == 2); //first time all groups
+	reset();
+	z21.setS88Data(s88, 20);
+	z21.flush();
+	CHECK(sent.empty());
+	s88[15] = 0x01;
+	z21.setS88Data(s88, 20);
+	z21.flush();
+	CHECK(countFrames(1, LAN_RMBUS_DATACHANGED, 0) == 1);
+	CHECK(sent.size() == 1 && sent[0].data[4] == 1); //group 1
+}
+
+//LAN_X_LOCO_INFO only to the clients that asked for the loco (user-009)
+static void testLocoSubscription()
+{
+	z21Class z21;
+	logon(z21, 1, Z21bcAll);
+	logon(z21, 2, Z21bcAll);
+	getLocoInfo(z21, 1, 3);
+	getLocoInfo(z21, 2, 0); //loco address 0 is a valid subscription
+	reset();
+	z21.setLocoStateFull(3, DCCSTEP128, 0x20, 0, 0, 0, 0, true);
+	z21.flush();
+	CHECK(countLocoInfo(1, 3) == 1);
+	CHECK(countLocoInfo(2, 3) == 0);
+	reset();
+	z21.setLocoStateFull(0, DCCSTEP128, 0x20, 0, 0, 0, 0, true);
+	z21.flush();
+	CHECK(countLocoInfo(1, 0) == 0);
+	CHECK(countLocoInfo(2, 0) == 1);
+}
+
+//a toggle is resolved with a known loco state, otherwise forwarded (user-008)
+static void testToggle()
+{
+	z21Class z21;
+	logon(z21, 1, 0);
+	z21.setLocoStateFull(3, DCCSTEP128, 0, 0x00, 0, 0, 0, false);
+	fktCalls = 0;
+	setLocoFkt(z21, 1, 3, 2, 0); //toggle F0
+	CHECK(fktCalls == 1 && fktAdr == 3 && fktType == 1 && fktFkt == 0);
+	setLocoFkt(z21, 1, 3, 2, 0);
+	CHECK(fktCalls == 2 && fktType == 0);
+	setLocoFkt(z21, 1, 5, 2, 1); //not known
+	CHECK(fktCalls == 3 && fktAdr == 5 && fktType == 2 && fktFkt == 1);
+	setLocoFkt(z21, 1, 3, 1, 40); //F40
+	CHECK(fktCalls == 4 && fktType == 1 && fktFkt == 40);
+	setLocoFkt(z21, 1, 3, 3, 2); //type 3
+	CHECK(fktCalls == 5 && fktType == 3 && fktFkt == 2);
+	locoStateAsked = 0;
+	getLocoInfo(z21, 1, 5);
+	CHECK(locoStateAsked == 1); //the toggle did not store a state
+}
+
+//a loco with address 0 does not take a free place of the loco states (user-007)
+static void testLocoCache()
+{
+	z21Class z21;
+	logon(z21, 1, 0);
+	for (uint16_t a = 1; a < z21LocoMAX; a++)
+		z21.setLocoStateFull(a, DCCSTEP128, 0, 0, 0, 0, 0, false);
+	setLocoDrive(z21, 1, 0, 0x20);
+	z21.setLocoStateFull(99, DCCSTEP128, 0, 0, 0, 0, 0, false);
+	locoStateAsked = 0;
+	getLocoInfo(z21, 1, 1); //least recently used
+	CHECK(locoStateAsked == 0);
+	//a loco in use stays, the least recently used one goes
+	getLocoInfo(z21, 1, 2);
+	z21.setLocoStateFull(100, DCCSTEP128, 0, 0, 0, 0, 0, false);
+	locoStateAsked = 0;
+	getLocoInfo(z21, 1, 2);
+	CHECK(locoStateAsked == 0);
+	getLocoInfo(z21, 1, 3);
+	CHECK(locoStateAsked == 1);
+}
+
+#if defined(z21SpeedQueue)
+//stop and power off remove the waiting speed commands (user-012)
+static void testSpeedQueueStop()
+{
+	z21Class z21;
+	station = &z21;
+	logon(z21, 1, Z21bcAll);
+	uint16_t Adr;
+	uint8_t speed, steps;
+	setLocoDrive(z21, 1, 3, 0xA0);
+	setStop(z21, 1);
+	CHECK(!z21.pollLocoSpeed(&Adr, &speed, &steps));
+	setLocoDrive(z21, 1, 3, 0xA0);
+	uint8_t off[] = {LAN_X_GET_SETTING, 0x80};
+	receiveX(z21, 1, off, sizeof(off));
+	CHECK(!z21.pollLocoSpeed(&Adr, &speed, &steps));
+	station = NULL;
+}
+#endif
+
+#if defined(z21TxBuffer) && !defined(z21TxRetry)
+//a power off the transport could not send goes first, not lost (user-018)
+static void testBufferPowerOff()
+{
+	z21Class z21;
+	logon(z21, 1, Z21bcAll | Z21bcRBus);
+	reset();
+	busy = true;
+	byte s88[10] = {0};
+	z21.setS88DataFull(s88, 10);
+	z21.setTrntInfo(5, true);
+	z21.flush();
+	z21.setPower(csTrackVoltageOff);
+	CHECK(z21.getTxDropped() == 0);
+	busy = false;
+	z21.flush();
+	CHECK(findFrame(LAN_X_Header, LAN_X_BC_TRACK_POWER, 0x00) == 0);
+	CHECK(countFrames(1, LAN_RMBUS_DATACHANGED, 0) == 1);
+	CHECK(countFrames(1, LAN_X_Header, LAN_X_TURNOUT_INFO) == 1);
+}
+#endif
+
+#if defined(z21TxRetry)
+//a waiting power off for all clients goes before the frames of a client (user-018)
+static void testRetryPowerOff()
+{
+	z21Class z21;
+	logon(z21, 1, Z21bcAll | Z21bcRBus);
+	reset();
+	busy = true;
+	z21.setPower(csTrackVoltageOff);
+	byte s88[10] = {0};
+	z21.setS88DataFull(s88, 10);
+	busy = false;
+	z21.flush();
+	int power = findFrame(LAN_X_Header, LAN_X_BC_TRACK_POWER, 0x00);
+	int s88Frame = findFrame(LAN_RMBUS_DATACHANGED, 0, 0);
+	CHECK(power == 0);
+	CHECK(s88Frame > power);
+	CHECK(z21.getTxDropped() == 0);
+}
+#endif
+
+int main()
+{
+	testDatagram();
+	testMalformed();
+	testStopLatency();
+	testS88();
+	testLocoSubscription();
+	testToggle();
+	testLocoCache();
+#if defined(z21SpeedQueue)
+	testSpeedQueueStop();
+#endif
+#if defined(z21TxBuffer) && !defined(z21TxRetry)
+	testBufferPowerOff();
+#endif
+#if defined(z21TxRetry)
+	testRetryPowerOff();
+#endif
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
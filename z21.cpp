@@ -15,6 +15,7 @@
 #include <z21.h>
 #include <z21header.h>
 
+#if z21ConfStore
 #if defined(__arm__)
 #include <DueFlashStorage.h>
 DueFlashStorage FlashStore;
@@ -40,18 +41,205 @@ DueFlashStorage FlashStore;
 #endif
 #endif
 #endif
+#endif
+
+//Z21 BC flag for each bit of the local stored flag
+static const unsigned long z21BcFlagTable[z21bcLocalBits] PROGMEM = {
+	Z21bcAll,							//Z21bcAll_s
+	Z21bcRBus,						//Z21bcRBus_s
+	Z21bcSystemInfo,			//Z21bcSystemInfo_s
+	Z21bcNetAll,					//Z21bcNetAll_s
+	Z21bcLocoNet,					//Z21bcLocoNet_s
+	Z21bcLocoNetLocos,		//Z21bcLocoNetLocos_s
+	Z21bcLocoNetSwitches, //Z21bcLocoNetSwitches_s
+	Z21bcLocoNetGBM,			//Z21bcLocoNetGBM_s
+	Z21bcRailcom,					//Z21bcRailcom_s
+	Z21bcRailComAll,			//Z21bcRailComAll_s
+	Z21bcCANDetector			//Z21bcCANDetector_s
+};
+
+//--------------------------------------------------------------------------------------------
+//Handler for each known message, see receiveMessage
+enum {
+	z21hNone, //no answer or too short
+	z21hUnknown,
+	z21hMalformed, //length or XOR wrong
+	z21hSerialNumber,
+	z21hHWInfo,
+	z21hLogoff,
+	z21hGetCode,
+	z21hGetVersion,
+	z21hGetStatus,
+	z21hPowerOff,
+	z21hPowerOn,
+	z21hCVRead,
+	z21hCVWrite,
+	z21hCVPom,
+	z21hCVPomAccessory,
+	z21hGetTurnoutInfo,
+	z21hSetTurnout,
+	z21hSetStop,
+	z21hGetLocoInfo,
+	z21hLocoFkt,
+	z21hLocoDrive,
+	z21hGetFirmware,
+	z21hSetBcFlags,
+	z21hGetBcFlags,
+	z21hRBusGetData,
+	z21hSystemState,
+	z21hRailComGetData,
+	z21hLNFromLan,
+	z21hLNDispatch,
+	z21hLNDetector,
+	z21hCANDetector,
+	z21hConf1Read,
+	z21hConf1Write,
+	z21hConf2Read,
+	z21hConf2Write,
+	z21hStats,
+	z21hCount //number of handlers
+};
+
+#define z21DispatchDB0 0x01 //DB0 must match
+#define z21DispatchXOR 0x02 //with X-Bus XOR
+
+struct z21Dispatch {
+	byte header;	 //LAN Header (LSB)
+	byte xheader;	 //X-Header, only for LAN_X_Header
+	byte db0;			 //DB0, only with z21DispatchDB0
+	byte flags;
+	byte minLen;	 //min. length of the message
+	byte maxLen;	 //max. length of the message, 0 = no limit
+	byte handler;
+};
+
+//all known messages, sorted by header, X-Header and DB0
+static constexpr z21Dispatch z21DispatchTable[] PROGMEM = {
+	{LAN_GET_SERIAL_NUMBER, 0, 0, 0, 4, 0, z21hSerialNumber},
+#if z21ConfStore
+	{0x12, 0, 0, 0, 4, 0, z21hConf1Read},
+	{0x13, 0, 0, 0, 14, 0, z21hConf1Write},
+	{0x16, 0, 0, 0, 4, 0, z21hConf2Read},
+	{0x17, 0, 0, 0, 20, 0, z21hConf2Write},
+#endif
+	{LAN_GET_CODE, 0, 0, 0, 4, 0, z21hGetCode},
+	{LAN_GET_HWINFO, 0, 0, 0, 4, 0, z21hHWInfo},
+	{LAN_LOGOFF, 0, 0, 0, 4, 0, z21hLogoff},
+	{LAN_X_Header, LAN_X_GET_SETTING, 0x21, z21DispatchDB0 | z21DispatchXOR, 7, 0, z21hGetVersion},
+	{LAN_X_Header, LAN_X_GET_SETTING, 0x24, z21DispatchDB0 | z21DispatchXOR, 7, 0, z21hGetStatus},
+	{LAN_X_Header, LAN_X_GET_SETTING, 0x80, z21DispatchDB0 | z21DispatchXOR, 7, 0, z21hPowerOff},
+	{LAN_X_Header, LAN_X_GET_SETTING, 0x81, z21DispatchDB0 | z21DispatchXOR, 7, 0, z21hPowerOn},
+	{LAN_X_Header, LAN_X_CV_READ, 0x11, z21DispatchDB0 | z21DispatchXOR, 9, 0, z21hCVRead},
+	{LAN_X_Header, LAN_X_CV_WRITE, 0x12, z21DispatchDB0 | z21DispatchXOR, 10, 0, z21hCVWrite},
+	{LAN_X_Header, LAN_X_GET_TURNOUT_INFO, 0, z21DispatchXOR, 8, 0, z21hGetTurnoutInfo},
+	{LAN_X_Header, LAN_X_SET_TURNOUT, 0, z21DispatchXOR, 9, 0, z21hSetTurnout},
+	{LAN_X_Header, LAN_X_SET_STOP, 0, z21DispatchXOR, 6, 0, z21hSetStop},
+	{LAN_X_Header, LAN_X_GET_LOCO_INFO, 0xF0, z21DispatchDB0 | z21DispatchXOR, 9, 0, z21hGetLocoInfo},
+	{LAN_X_Header, LAN_X_SET_LOCO, 0, z21DispatchXOR, 10, 0, z21hLocoDrive},
+	{LAN_X_Header, LAN_X_SET_LOCO, LAN_X_SET_LOCO_FUNCTION, z21DispatchDB0 | z21DispatchXOR, 10, 0, z21hLocoFkt},
+	{LAN_X_Header, LAN_X_CV_POM, 0x30, z21DispatchDB0 | z21DispatchXOR, 12, 0, z21hCVPom},
+	{LAN_X_Header, LAN_X_CV_POM, 0x31, z21DispatchDB0 | z21DispatchXOR, 7, 0, z21hCVPomAccessory},
+	{LAN_X_Header, LAN_X_GET_FIRMWARE_VERSION, 0, z21DispatchXOR, 7, 0, z21hGetFirmware},
+	{LAN_SET_BROADCASTFLAGS, 0, 0, 0, 8, 0, z21hSetBcFlags},
+	{LAN_GET_BROADCASTFLAGS, 0, 0, 0, 4, 0, z21hGetBcFlags},
+	{LAN_GET_LOCOMODE, 0, 0, 0, 4, 0, z21hNone},
+	{LAN_SET_LOCOMODE, 0, 0, 0, 4, 0, z21hNone},
+	{LAN_GET_TURNOUTMODE, 0, 0, 0, 4, 0, z21hNone},
+	{LAN_SET_TURNOUTMODE, 0, 0, 0, 4, 0, z21hNone},
+	{LAN_RMBUS_GETDATA, 0, 0, 0, 5, 0, z21hRBusGetData},
+	{LAN_RMBUS_PROGRAMMODULE, 0, 0, 0, 4, 0, z21hNone},
+	{LAN_SYSTEMSTATE_GETDATA, 0, 0, 0, 4, 0, z21hSystemState},
+	{LAN_RAILCOM_GETDATA, 0, 0, 0, 7, 0, z21hRailComGetData},
+#if z21LocoNet
+	{LAN_LOCONET_FROM_LAN, 0, 0, 0, 5, 0x04 + z21LNMAX, z21hLNFromLan},
+	{LAN_LOCONET_DISPATCH_ADDR, 0, 0, 0, 6, 0, z21hLNDispatch},
+	{LAN_LOCONET_DETECTOR, 0, 0, 0, 7, 0, z21hLNDetector},
+#endif
+#if z21CAN
+	{LAN_CAN_DETECTOR, 0, 0, 0, 7, 0, z21hCANDetector},
+#endif
+#if defined(z21Stats) && defined(z21StatsHeader)
+	{z21StatsHeader, 0, 0, 0, 5, 0, z21hStats},
+#endif
+};
+
+#define z21DispatchCount (sizeof(z21DispatchTable) / sizeof(z21Dispatch))
+
+//check at compile time that the table is sorted
+constexpr bool z21DispatchSorted(const z21Dispatch *t, unsigned int n)
+{
+	return n < 2 || ((((unsigned long)t[0].header << 16) | (t[0].xheader << 8) | t[0].db0) < (((unsigned long)t[1].header << 16) | (t[1].xheader << 8) | t[1].db0) && z21DispatchSorted(t + 1, n - 1));
+}
+static_assert(z21DispatchSorted(z21DispatchTable, z21DispatchCount), "z21DispatchTable is not sorted");
+
+#if defined(z21Stats)
+static_assert(z21hCount <= z21StatsMessages, "z21StatsMessages is too small");
+
+//bin of a log2 histogram: 0 = 0, n = 2^(n-1) to 2^n-1, last bin = more
+static byte z21StatsBin(unsigned long value, byte bins)
+{
+	byte bin = 0;
+	while (value != 0 && bin < bins - 1)
+	{
+		value >>= 1;
+		bin++;
+	}
+	return bin;
+}
+#endif
+
+//the sketch was compiled with other size options (z21clientMAX, ...) than the library
+static bool z21SizeError = false;
 
 // Constructor /////////////////////////////////////////////////////////////////
 // Function that handles the creation and setup of instances
 
-z21Class::z21Class()
+z21Class::z21Class(size_t size)
 {
+	if (size != sizeof(z21Class))
+	{ //the memory of the sketch does not fit, do not touch it
+		z21SizeError = true;
+		return;
+	}
 	// initialize this instance's variables
+	Clock = millis;
 	z21IPpreviousMillis = 0;
+	memset(LocoState, 0, sizeof(LocoState));
+	for (byte i = 0; i < z21LocoMAX; i++)
+		LocoState[i].Adr = z21LocoNone; //free
+	S88Modules = 0;
+	S88ModulesSend = 0xFF;
+	StopPending = false;
+#if defined(z21Capture)
+	InReceive = false;
+#endif
+	RxMalformed = 0;
+	TxDropped = 0;
+	TxSuperseded = 0;
+#if defined(z21Trace)
+	TraceFirst = 0;
+	TraceLen = 0;
+	TraceLost = 0;
+#endif
+#if defined(z21Stats)
+	memset(&Stats, 0, sizeof(Stats));
+#endif
+	StopLatency = 0;
+	StopLatencyMax = 0;
+#if defined(z21SpeedQueue)
+	SpeedQueueLen = 0;
+#endif
 	Railpower = csTrackVoltageOff;
 	clearIPSlots();
 }
 
+//--------------------------------------------------------------------------------------------
+//size options of the sketch and the library differ, set them as build flags (-D)
+bool z21Class::getSizeError()
+{
+	return z21SizeError;
+}
+
 // Public Methods //////////////////////////////////////////////////////////////
 // Functions available in Wiring sketches, this library, and other libraries
 
@@ -59,27 +247,138 @@ z21Class::z21Class()
 //Daten ermitteln und Auswerten
 void z21Class::receive(uint8_t client, uint8_t *packet)
 {
+	receive(client, packet, word(packet[1], packet[0])); //only the first message
+}
+
+//--------------------------------------------------------------------------------------------
+//Alle Meldungen eines UDP Datagramm auswerten
+void z21Class::receive(uint8_t client, uint8_t *packet, uint16_t length)
+{
+	if (z21SizeError)
+		return;
+#if defined(z21Capture)
+	TypeSpan datagram = {packet, length};
+	capture(client, z21CaptureRX, &datagram, 1);
+	InReceive = true;
+#endif
+#if defined(z21Stats)
+	unsigned long start = micros();
+	Stats.rxDatagrams++;
+#endif
+	ageIP(Clock());
 	addIPToSlot(client, 0);
+	//in the order of the datagram, a stop must not run before an earlier command
+	uint8_t *msg = packet;
+	uint16_t rest = length;
+	while (rest >= 4)
+	{
+		uint16_t DataLen = word(msg[1], msg[0]);
+		if (DataLen < 4 || DataLen > rest)
+		{ //broken message, drop the rest of the datagram
+			RxMalformed++;
+#if defined(z21Trace)
+			trace(z21TraceBad, client, msg[2], 0, 0, DataLen);
+#endif
+			break;
+		}
+		receiveMessage(client, msg);
+		msg += DataLen;
+		rest -= DataLen;
+	}
+	sendLocoInfoChanged();
+	flush();
+#if defined(z21Stats)
+	countTime(Stats.receiveTime, start);
+#endif
+#if defined(z21Capture)
+	InReceive = false;
+#endif
+}
+
+//--------------------------------------------------------------------------------------------
+//call regularly (also without received packets): remove clients that are not active any more,
+//send the collected and waiting frames
+void z21Class::tick(unsigned long now)
+{
+	if (z21SizeError)
+		return;
+	ageIP(now);
+	flush();
+}
+
+//--------------------------------------------------------------------------------------------
+//with the time of the clock
+void z21Class::tick()
+{
+	tick(Clock());
+}
+
+//--------------------------------------------------------------------------------------------
+//time source in milliseconds for the client timeout, default millis()
+//a host build can use a simulated time
+void z21Class::setClock(unsigned long (*clock)(void))
+{
+	if (z21SizeError)
+		return;
+	if (clock != NULL)
+		Clock = clock;
+	else
+		Clock = millis;
+}
+
+//--------------------------------------------------------------------------------------------
+//check if IP is still used, each interval only the clients of one bucket run out
+//the times are compared as 32 bit like millis(), also where unsigned long has 64 bit (host)
+void z21Class::ageIP(unsigned long now)
+{
+	for (byte n = 0; (uint32_t)(now - z21IPpreviousMillis) >= z21IPinterval; n++)
+	{
+		if (n == z21WheelSize)
+		{ //all clients are checked, skip the rest
+			z21IPpreviousMillis = now;
+			break;
+		}
+		z21IPpreviousMillis = (uint32_t)(z21IPpreviousMillis + z21IPinterval);
+		WheelPos = (WheelPos + 1) % z21WheelSize;
+		while (WheelHead[WheelPos] < z21clientMAX)
+			clearIP(WheelHead[WheelPos]); //clear IP DATA, only the clients that run out
+	}
+}
+
+//--------------------------------------------------------------------------------------------
+//Eine einzelne Meldung auswerten
+void z21Class::receiveMessage(uint8_t client, uint8_t *packet)
+{
 	// send a reply, to the IP address and port that sent us the packet we received
-	int header = (packet[3] << 8) + packet[2];
 	byte data[16]; //z21 send storage
 
-	switch (header)
-	{
-	case LAN_GET_SERIAL_NUMBER:
-#if defined(SERIALDEBUG)
-		ZDebug.println("GET_SERIAL_NUMBER");
+	byte handler = getHandler(packet);
+#if defined(z21Trace)
+	byte event = z21TraceRX;
+	if (handler == z21hMalformed)
+		event = z21TraceBad;
+	else if (handler == z21hUnknown)
+		event = z21TraceUnknown;
+	uint16_t len = word(packet[1], packet[0]);
+	byte first = (packet[2] == LAN_X_Header) ? 5 : 4; //first data byte
+	trace(event, client, packet[2], (packet[2] == LAN_X_Header && len > 4) ? packet[4] : 0, (len > first) ? packet[first] : 0, len);
+#endif
+#if defined(z21Stats)
+	Stats.rxMessage[handler]++;
 #endif
+	switch (handler)
+	{
+	case z21hMalformed:
+		RxMalformed++;
+		break;
+	case z21hSerialNumber:
 		data[0] = z21SnLSB;
 		data[1] = z21SnMSB;
 		data[2] = 0x00;
 		data[3] = 0x00;
 		EthSend(client, 0x08, LAN_GET_SERIAL_NUMBER, data, false, Z21bcNone); //Seriennummer 32 Bit (little endian)
 		break;
-	case LAN_GET_HWINFO:
-#if defined(SERIALDEBUG)
-		ZDebug.println("GET_HWINFO");
-#endif
+	case z21hHWInfo:
 		data[0] = z21HWTypeLSB; //HwType 32 Bit
 		data[1] = z21HWTypeMSB;
 		data[2] = 0x00;
@@ -90,204 +389,176 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 		data[7] = 0x00;
 		EthSend(client, 0x0C, LAN_GET_HWINFO, data, false, Z21bcNone);
 		break;
-	case LAN_LOGOFF:
-#if defined(SERIALDEBUG)
-		ZDebug.println("LOGOFF");
-#endif
+	case z21hLogoff:
 		clearIPSlot(client);
 		//Antwort von Z21: keine
 		break;
-	case LAN_GET_CODE: //SW Feature-Umfang der Z21
+	case z21hGetCode: //SW Feature-Umfang der Z21
 		/*#define Z21_NO_LOCK        0x00  // keine Features gesperrt 
 			#define z21_START_LOCKED   0x01  // �z21 start�: Fahren und Schalten per LAN gesperrt 
 			#define z21_START_UNLOCKED 0x02  // �z21 start�: alle Feature-Sperren aufgehoben */
 		data[0] = 0x00; //keine Features gesperrt
 		EthSend(client, 0x05, LAN_GET_CODE, data, false, Z21bcNone);
 		break;
-	case (LAN_X_Header):
-		switch (packet[4])
-		{ //X-Header
-		case LAN_X_GET_SETTING:
-			switch (packet[5])
-			{ //DB0
-			case 0x21:
-#if defined(SERIALDEBUG)
-				ZDebug.println("X_GET_VERSION");
-#endif
-				data[0] = LAN_X_GET_VERSION; //X-Header: 0x63
-				data[1] = 0x21;							 //DB0
-				data[2] = 0x30;							 //X-Bus Version
-				data[3] = 0x12;							 //ID der Zentrale
-				EthSend(client, 0x09, LAN_X_Header, data, true, Z21bcNone);
-				break;
-			case 0x24:
-				data[0] = LAN_X_STATUS_CHANGED; //X-Header: 0x62
-				data[1] = 0x22;									//DB0
-				data[2] = Railpower;						//DB1: Status
-				//ZDebug.print("X_GET_STATUS ");
-				//csEmergencyStop  0x01 // Der Nothalt ist eingeschaltet
-				//csTrackVoltageOff  0x02 // Die Gleisspannung ist abgeschaltet
-				//csShortCircuit  0x04 // Kurzschluss
-				//csProgrammingModeActive 0x20 // Der Programmiermodus ist aktiv
-				EthSend(client, 0x08, LAN_X_Header, data, true, Z21bcNone);
-				break;
-			case 0x80:
-#if defined(SERIALDEBUG)
-				ZDebug.println("X_SET_TRACK_POWER_OFF");
-#endif
-				if (notifyz21RailPower)
-					notifyz21RailPower(csTrackVoltageOff);
-				break;
-			case 0x81:
-#if defined(SERIALDEBUG)
-				ZDebug.println("X_SET_TRACK_POWER_ON");
-#endif
-				if (notifyz21RailPower)
-					notifyz21RailPower(csNormal);
-				break;
-			}
-			break; //ENDE DB0
-		case LAN_X_CV_READ:
-			if (packet[5] == 0x11)
-			{ //DB0
-#if defined(SERIALDEBUG)
-				ZDebug.println("X_CV_READ");
-#endif
-				if (notifyz21CVREAD)
-					notifyz21CVREAD(packet[6], packet[7]); //CV_MSB, CV_LSB
-			}
-			break;
-		case LAN_X_CV_WRITE:
-			if (packet[5] == 0x12)
-			{ //DB0
-#if defined(SERIALDEBUG)
-				ZDebug.println("X_CV_WRITE");
-#endif
-				if (notifyz21CVWRITE)
-					notifyz21CVWRITE(packet[6], packet[7], packet[8]); //CV_MSB, CV_LSB, value
-			}
-			break;
-		case LAN_X_CV_POM:
-			if (packet[5] == 0x30)
-			{ //DB0
-				uint8_t Adr = ((packet[6] & 0x3F) << 8) + packet[7];
-				uint8_t CVAdr = ((packet[8] & B11) << 8) + packet[9];
-				byte value = packet[10];
-				if ((packet[8] >> 2) == B111011)
-				{
-#if defined(SERIALDEBUG)
-					ZDebug.println("LAN_X_CV_POM_WRITE_BYTE");
-#endif
-					if (notifyz21CVPOMWRITEBYTE)
-						notifyz21CVPOMWRITEBYTE(Adr, CVAdr, value); //set decoder
-				}
-				else if ((packet[8] >> 2) == B111010 && value == 0)
-				{
-#if defined(SERIALDEBUG)
-					ZDebug.println("LAN_X_CV_POM_WRITE_BIT");
-#endif
-				}
-				else
-				{
-#if defined(SERIALDEBUG)
-					ZDebug.println("LAN_X_CV_POM_READ_BIYTE");
-#endif
-					if (notifyz21CVPOMREADBYTE)
-						notifyz21CVPOMREADBYTE(Adr, CVAdr); //set decoder
-				}
-			}
-			else if (packet[5] == 0x31)
-			{ //DB0
-#if defined(SERIALDEBUG)
-				ZDebug.println("LAN_X_CV_POM_ACCESSORY");
+	case z21hGetVersion:
+		data[0] = LAN_X_GET_VERSION; //X-Header: 0x63
+		data[1] = 0x21;							 //DB0
+		data[2] = 0x30;							 //X-Bus Version
+		data[3] = 0x12;							 //ID der Zentrale
+		EthSend(client, 0x09, LAN_X_Header, data, true, Z21bcNone);
+		break;
+	case z21hGetStatus:
+		data[0] = LAN_X_STATUS_CHANGED; //X-Header: 0x62
+		data[1] = 0x22;									//DB0
+		data[2] = Railpower;						//DB1: Status
+		//ZDebug.print("X_GET_STATUS ");
+		//csEmergencyStop  0x01 // Der Nothalt ist eingeschaltet
+		//csTrackVoltageOff  0x02 // Die Gleisspannung ist abgeschaltet
+		//csShortCircuit  0x04 // Kurzschluss
+		//csProgrammingModeActive 0x20 // Der Programmiermodus ist aktiv
+		EthSend(client, 0x08, LAN_X_Header, data, true, Z21bcNone);
+		break;
+	case z21hPowerOff:
+		StopMicros = micros(); //measure time until the answer is send
+		StopPending = true;
+#if defined(z21SpeedQueue)
+		SpeedQueueLen = 0; //no waiting command may restart a loco
 #endif
-			}
-			break;
-		case LAN_X_GET_TURNOUT_INFO:
+		if (notifyz21RailPower)
+			notifyz21RailPower(csTrackVoltageOff);
+		break;
+	case z21hPowerOn:
+		if (notifyz21RailPower)
+			notifyz21RailPower(csNormal);
+		break;
+	case z21hCVRead:
+		if (notifyz21CVREAD)
+			notifyz21CVREAD(packet[6], packet[7]); //CV_MSB, CV_LSB
+		break;
+	case z21hCVWrite:
+		if (notifyz21CVWRITE)
+			notifyz21CVWRITE(packet[6], packet[7], packet[8]); //CV_MSB, CV_LSB, value
+		break;
+	case z21hCVPom:
+	{
+		uint8_t Adr = ((packet[6] & 0x3F) << 8) + packet[7];
+		uint8_t CVAdr = ((packet[8] & B11) << 8) + packet[9];
+		byte value = packet[10];
+		if ((packet[8] >> 2) == B111011)
 		{
-#if defined(SERIALDEBUG)
-			ZDebug.print("X_GET_TURNOUT_INFO ");
-#endif
-			if (notifyz21AccessoryInfo)
-			{
-				data[0] = 0x43;			 //X-HEADER
-				data[1] = packet[5]; //High
-				data[2] = packet[6]; //Low
-				if (notifyz21AccessoryInfo((packet[5] << 8) + packet[6]) == true)
-					data[3] = 0x02; //active
-				else
-					data[3] = 0x01;																						 //inactive
-				EthSend(client, 0x09, LAN_X_Header, data, true, Z21bcAll_s); //BC new 23.04. !!! (old = 0)
-			}
-			break;
+			if (notifyz21CVPOMWRITEBYTE)
+				notifyz21CVPOMWRITEBYTE(Adr, CVAdr, value); //set decoder
 		}
-		case LAN_X_SET_TURNOUT:
+		else if ((packet[8] >> 2) == B111010 && value == 0)
 		{
-#if defined(SERIALDEBUG)
-			ZDebug.print("X_SET_TURNOUT Adr.:");
-			ZDebug.print((packet[5] << 8) + packet[6]);
-			ZDebug.print(":");
-			ZDebug.print(bitRead(packet[7], 0));
-			ZDebug.print("-");
-			ZDebug.println(bitRead(packet[7], 3));
-#endif
-			//bool TurnOnOff = bitRead(packet[7],3);  //Spule EIN/AUS
-			if (notifyz21Accessory)
-			{
-				notifyz21Accessory((packet[5] << 8) + packet[6], bitRead(packet[7], 0), bitRead(packet[7], 3));
-			} //	Addresse					Links/Rechts			Spule EIN/AUS
-			break;
+			//LAN_X_CV_POM_WRITE_BIT not supported
 		}
-		case LAN_X_SET_STOP:
-#if defined(SERIALDEBUG)
-			ZDebug.println("X_SET_STOP");
-#endif
-			if (notifyz21RailPower)
-				notifyz21RailPower(csEmergencyStop);
-			break;
-		case LAN_X_GET_LOCO_INFO:
-			if (packet[5] == 0xF0)
-			{ //DB0
-				//ZDebug.print("X_GET_LOCO_INFO: ");
-				//Antwort: LAN_X_LOCO_INFO  Adr_MSB - Adr_LSB
-				if (notifyz21getLocoState)
-					notifyz21getLocoState(((packet[6] & 0x3F) << 8) + packet[7], false);
-				//Antwort via "setLocoStateFull"!
-			}
-			break;
-		case LAN_X_SET_LOCO:
-			if (packet[5] == LAN_X_SET_LOCO_FUNCTION)
-			{ //DB0
-				//LAN_X_SET_LOCO_FUNCTION  Adr_MSB        Adr_LSB            Type (00=AUS/01=EIN/10=UM)      Funktion
-				if (notifyz21LocoFkt)
-					notifyz21LocoFkt(word(packet[6] & 0x3F, packet[7]), packet[8] >> 6, packet[8] & B00111111);
-				//uint16_t Adr, uint8_t type, uint8_t fkt
-			}
+		else
+		{
+			if (notifyz21CVPOMREADBYTE)
+				notifyz21CVPOMREADBYTE(Adr, CVAdr); //set decoder
+		}
+		break;
+	}
+	case z21hCVPomAccessory:
+		//LAN_X_CV_POM_ACCESSORY not supported
+		break;
+	case z21hGetTurnoutInfo:
+	{
+		if (notifyz21AccessoryInfo)
+		{
+			data[0] = 0x43;			 //X-HEADER
+			data[1] = packet[5]; //High
+			data[2] = packet[6]; //Low
+			if (notifyz21AccessoryInfo((packet[5] << 8) + packet[6]) == true)
+				data[3] = 0x02; //active
 			else
-			{ //DB0
-				//ZDebug.print("X_SET_LOCO_DRIVE ");
-				byte steps = 14;
-				if ((packet[5] & 0x03) == 3)
-					steps = 128;
-				else if ((packet[5] & 0x03) == 2)
-					steps = 28;
-				if (notifyz21LocoSpeed)
-					notifyz21LocoSpeed(word(packet[6] & 0x3F, packet[7]), packet[8], steps);
-			}
-			break;
-		case LAN_X_GET_FIRMWARE_VERSION:
-#if defined(SERIALDEBUG)
-			ZDebug.println("X_GET_FIRMWARE_VERSION");
-#endif
-			data[0] = 0xF3;						 //identify Firmware (not change)
-			data[1] = 0x0A;						 //identify Firmware (not change)
-			data[2] = z21FWVersionMSB; //V_MSB
-			data[3] = z21FWVersionLSB; //V_LSB
-			EthSend(client, 0x09, LAN_X_Header, data, true, Z21bcNone);
-			break;
+				data[3] = 0x01;																						 //inactive
+			EthSend(client, 0x09, LAN_X_Header, data, true, Z21bcAll_s); //BC new 23.04. !!! (old = 0)
+		}
+		break;
+	}
+	case z21hSetTurnout:
+	{
+		//bool TurnOnOff = bitRead(packet[7],3);  //Spule EIN/AUS
+		if (notifyz21Accessory)
+		{
+			notifyz21Accessory((packet[5] << 8) + packet[6], bitRead(packet[7], 0), bitRead(packet[7], 3));
+		} //	Addresse					Links/Rechts			Spule EIN/AUS
+		break;
+	}
+	case z21hSetStop:
+		StopMicros = micros(); //measure time until the answer is send
+		StopPending = true;
+#if defined(z21SpeedQueue)
+		SpeedQueueLen = 0; //no waiting command may restart a loco
+#endif
+		if (notifyz21RailPower)
+			notifyz21RailPower(csEmergencyStop);
+		break;
+	case z21hGetLocoInfo:
+	{
+		//ZDebug.print("X_GET_LOCO_INFO: ");
+		//Antwort: LAN_X_LOCO_INFO  Adr_MSB - Adr_LSB
+		addLocoSub(client, word(packet[6] & 0x3F, packet[7])); //BC for this loco
+		TypeLocoState *loco = getLocoState(word(packet[6] & 0x3F, packet[7]), false);
+		if (loco != NULL && loco->complete)
+			sendLocoInfo(client, loco, Z21bcNone); //known state, answer direct
+		else if (notifyz21getLocoState)
+			notifyz21getLocoState(((packet[6] & 0x3F) << 8) + packet[7], false);
+		//Antwort via "setLocoStateFull"!
+		break;
+	}
+	case z21hLocoFkt:
+	{
+		//LAN_X_SET_LOCO_FUNCTION  Adr_MSB        Adr_LSB            Type (00=AUS/01=EIN/10=UM)      Funktion
+		//toggle is resolved here when the full loco state is known, the sketch get the new state (00=AUS/01=EIN)
+		//otherwise and for F32-F63 or type 11 the message is forwarded unchanged
+		byte type = packet[8] >> 6;
+		TypeLocoState *loco = getLocoState(word(packet[6] & 0x3F, packet[7]), false);
+		if (loco != NULL && loco->complete)
+		{
+			byte state = setLocoFkt(loco, type, packet[8] & B00111111);
+			if (state <= 1)
+				type = state;
+		}
+		if (notifyz21LocoFkt)
+			notifyz21LocoFkt(word(packet[6] & 0x3F, packet[7]), type, packet[8] & B00111111);
+		//uint16_t Adr, uint8_t type, uint8_t fkt
+		break;
+	}
+	case z21hLocoDrive:
+	{
+		//ZDebug.print("X_SET_LOCO_DRIVE ");
+		byte steps = 14;
+		if ((packet[5] & 0x03) == 3)
+			steps = 128;
+		else if ((packet[5] & 0x03) == 2)
+			steps = 28;
+		TypeLocoState *loco = getLocoState(word(packet[6] & 0x3F, packet[7]), false);
+		if (loco != NULL)
+		{
+			loco->steps = packet[5] & 0x03;
+			if (loco->steps == 0)
+				loco->steps = DCCSTEP14;
+			loco->speed = packet[8];
 		}
+#if defined(z21SpeedQueue)
+		if (addLocoSpeed(word(packet[6] & 0x3F, packet[7]), packet[8], steps))
+			break; //read by pollLocoSpeed()
+#endif
+		if (notifyz21LocoSpeed)
+			notifyz21LocoSpeed(word(packet[6] & 0x3F, packet[7]), packet[8], steps);
+		break;
+	}
+	case z21hGetFirmware:
+		data[0] = 0xF3;						 //identify Firmware (not change)
+		data[1] = 0x0A;						 //identify Firmware (not change)
+		data[2] = z21FWVersionMSB; //V_MSB
+		data[3] = z21FWVersionLSB; //V_LSB
+		EthSend(client, 0x09, LAN_X_Header, data, true, Z21bcNone);
 		break;
-	case (LAN_SET_BROADCASTFLAGS):
+	case z21hSetBcFlags:
 	{
 		unsigned long bcflag = packet[7];
 		bcflag = packet[6] | (bcflag << 8);
@@ -297,14 +568,9 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 		//no inside of the protokoll, but good to have:
 		if (notifyz21RailPower)
 			notifyz21RailPower(Railpower); //Zustand Gleisspannung Antworten
-#if defined(SERIALDEBUG)
-		ZDebug.print("SET_BROADCASTFLAGS: ");
-		ZDebug.println(addIPToSlot(client, 0x00), BIN);
-// 1=BC Power, Loco INFO, Trnt INFO; 2=BC �nderungen der R�ckmelder am R-Bus
-#endif
 		break;
 	}
-	case (LAN_GET_BROADCASTFLAGS):
+	case z21hGetBcFlags:
 	{
 		unsigned long flag = getz21BcFlag(addIPToSlot(client, 0x00));
 		data[0] = flag;
@@ -312,42 +578,26 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 		data[2] = flag >> 16;
 		data[3] = flag >> 24;
 		EthSend(client, 0x08, LAN_GET_BROADCASTFLAGS, data, false, Z21bcNone);
-#if defined(SERIALDEBUG)
-		ZDebug.print("GET_BROADCASTFLAGS: ");
-		ZDebug.println(flag, BIN);
-#endif
 		break;
 	}
-	case (LAN_GET_LOCOMODE):
-		break;
-	case (LAN_SET_LOCOMODE):
-		break;
-	case (LAN_GET_TURNOUTMODE):
-		break;
-	case (LAN_SET_TURNOUTMODE):
-		break;
-	case (LAN_RMBUS_GETDATA):
-		if (notifyz21S88Data)
+	case z21hRBusGetData:
+		if (packet[4] * 10 < S88Modules && (S88Modules == S88ModulesSend || (packet[4] + 1) * 10 <= S88Modules))
+		{ //the group is stored, answer with the last send state, only to the request client
+			sendS88Group(client, packet[4], S88State, S88Modules, Z21bcNone);
+		}
+		else if (notifyz21S88Data)
 		{
-#if defined(SERIALDEBUG)
-			ZDebug.println("RMBUS_GETDATA");
-#endif
 			//ask for group state 'Gruppenindex'
 			notifyz21S88Data(packet[4]); //normal Antwort hier nur an den anfragenden Client! (Antwort geht hier an alle!)
 		}
 		break;
-	case (LAN_RMBUS_PROGRAMMODULE):
-		break;
-	case (LAN_SYSTEMSTATE_GETDATA):
+	case z21hSystemState:
 	{ //System state
-#if defined(SERIALDEBUG)
-		ZDebug.println("LAN_SYS-State");
-#endif
 		if (notifyz21getSystemInfo)
 			notifyz21getSystemInfo(client);
 		break;
 	}
-	case (LAN_RAILCOM_GETDATA):
+	case z21hRailComGetData:
 	{
 		uint16_t Adr = 0;
 		if (packet[4] == 0x01)
@@ -374,58 +624,47 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 		EthSend(client, 0x0E, LAN_RAILCOM_DATACHANGED, data, false, Z21bcNone);
 		break;
 	}
-	case (LAN_LOCONET_FROM_LAN):
+#if z21LocoNet
+	case z21hLNFromLan:
 	{
-#if defined(SERIALDEBUG)
-		ZDebug.println("LOCONET_FROM_LAN");
-#endif
 		if (notifyz21LNSendPacket)
 		{
-			byte LNdata[packet[0] - 0x04]; //n Bytes
-			for (byte i = 0; i < (packet[0] - 0x04); i++)
-				LNdata[i] = packet[0x04 + i];
-			notifyz21LNSendPacket(LNdata, packet[0] - 0x04);
+			//LN message direct out of the packet, length is checked by the dispatch table
+			notifyz21LNSendPacket(&packet[0x04], packet[0] - 0x04);
 			//Melden an andere LAN-Client das Meldung auf LocoNet-Bus geschrieben wurde
-			EthSend(client, packet[0], LAN_LOCONET_FROM_LAN, packet, false, Z21bcLocoNet_s); //LAN_LOCONET_FROM_LAN
+			TypeSpan span = {packet, packet[0]};
+			EthSendFrame(client, &span, 1, Z21bcLocoNet_s); //LAN_LOCONET_FROM_LAN unverändert weiter
 		}
 		break;
 	}
-	case (LAN_LOCONET_DISPATCH_ADDR):
+	case z21hLNDispatch:
 	{
 		if (notifyz21LNdispatch)
 		{
 			data[0] = packet[4];
 			data[1] = packet[5];
 			data[2] = notifyz21LNdispatch(packet[5], packet[4]); //dispatchSlot
-#if defined(SERIALDEBUG)
-			ZDebug.print("LOCONET_DISPATCH_ADDR ");
-			ZDebug.print(word(packet[5], packet[4]));
-			ZDebug.print(",");
-			ZDebug.println(data[2]);
-#endif
 			EthSend(client, 0x07, LAN_LOCONET_DISPATCH_ADDR, data, false, Z21bcNone);
 		}
 		break;
 	}
-	case (LAN_LOCONET_DETECTOR):
+	case z21hLNDetector:
 		if (notifyz21LNdetector)
 		{
-#if defined(SERIALDEBUG)
-			ZDebug.println("LOCONET_DETECTOR Abfrage");
-#endif
 			notifyz21LNdetector(packet[4], word(packet[6], packet[5])); //Anforderung Typ & Reportadresse
 		}
 		break;
-	case (LAN_CAN_DETECTOR):
+#endif
+#if z21CAN
+	case z21hCANDetector:
 		if (notifyz21CANdetector)
 		{
-#if defined(SERIALDEBUG)
-			ZDebug.println("CAN_DETECTOR Abfrage");
-#endif
 			notifyz21CANdetector(packet[4], word(packet[6], packet[5])); //Anforderung Typ & CAN-ID
 		}
 		break;
-	case (0x12): //configuration read
+#endif
+#if z21ConfStore
+	case z21hConf1Read: //configuration read
 		// <-- 04 00 12 00
 		// 0e 00 12 00 01 00 01 03 01 00 03 00 00 00
 		for (byte i = 0; i < 10; i++)
@@ -433,32 +672,8 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 			data[i] = FSTORAGE.read(CONF1STORE + i);
 		}
 		EthSend(client, 0x0e, 0x12, data, false, Z21bcNone);
-#if defined(SERIALDEBUG)
-		ZDebug.print("Z21 Eins(read) ");
-		ZDebug.print("RailCom: ");
-		ZDebug.print(data[0], HEX);
-		ZDebug.print(", PWR-Button: ");
-		ZDebug.print(data[2], HEX);
-		ZDebug.print(", ProgRead: ");
-		switch (data[3])
-		{
-		case 0x00:
-			ZDebug.print("nothing");
-			break;
-		case 0x01:
-			ZDebug.print("Bit");
-			break;
-		case 0x02:
-			ZDebug.print("Byte");
-			break;
-		case 0x03:
-			ZDebug.print("both");
-			break;
-		}
-		ZDebug.println();
-#endif
 		break;
-	case (0x13):
+	case z21hConf1Write:
 	{ //configuration write
 //<-- 0e 00 13 00 01 00 01 03 01 00 03 00 00 00
 //0x0e = Length; 0x12 = Header
@@ -468,30 +683,6 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 			(0x01) Power-Button: 0=Gleisspannung aus, 1=Nothalt
 			(0x03) Auslese-Modus: 0=Nichts, 1=Bit, 2=Byte, 3=Beides
 			*/
-#if defined(SERIALDEBUG)
-		ZDebug.print("Z21 Eins(write) ");
-		ZDebug.print("RailCom: ");
-		ZDebug.print(packet[4], HEX);
-		ZDebug.print(", PWR-Button: ");
-		ZDebug.print(packet[6], HEX);
-		ZDebug.print(", ProgRead: ");
-		switch (packet[7])
-		{
-		case 0x00:
-			ZDebug.print("nothing");
-			break;
-		case 0x01:
-			ZDebug.print("Bit");
-			break;
-		case 0x02:
-			ZDebug.print("Byte");
-			break;
-		case 0x03:
-			ZDebug.print("both");
-			break;
-		}
-		ZDebug.println();
-#endif
 		for (byte i = 0; i < 10; i++)
 		{
 			FSTORAGE.FSTORAGEMODE(CONF1STORE + i, packet[4 + i]);
@@ -501,7 +692,7 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 			notifyz21UpdateConf();
 		break;
 	}
-	case (0x16): //configuration read
+	case z21hConf2Read: //configuration read
 		//<-- 04 00 16 00
 		//14 00 16 00 19 06 07 01 05 14 88 13 10 27 32 00 50 46 20 4e
 		for (byte i = 0; i < 16; i++)
@@ -509,22 +700,8 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 			data[i] = FSTORAGE.read(CONF2STORE + i);
 		}
 		EthSend(client, 0x14, 0x16, data, false, Z21bcNone);
-#if defined(SERIALDEBUG)
-		ZDebug.print("Z21 Eins(read) ");
-		ZDebug.print("RstP(s): ");
-		ZDebug.print(data[0]);
-		ZDebug.print(", RstP(f): ");
-		ZDebug.print(data[1]);
-		ZDebug.print(", ProgP: ");
-		ZDebug.print(data[2]);
-		ZDebug.print(", MainV: ");
-		ZDebug.print(word(data[13], data[12]));
-		ZDebug.print(", ProgV: ");
-		ZDebug.print(word(data[15], data[14]));
-		ZDebug.println();
-#endif
-		break;
-	case (0x17):
+		break;
+	case z21hConf2Write:
 	{ //configuration write
 //<-- 14 00 17 00 19 06 07 01 05 14 88 13 10 27 32 00 50 46 20 4e
 //0x14 = Length; 0x16 = Header(read), 0x17 = Header(write)
@@ -546,20 +723,6 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 			(0x20) Programmiergleis (LSB) (12-22V): 20V=0x4e20, 21V=0x5208, 22V=0x55F0
 			(0x4e) Programmiergleis (MSB)
 			*/
-#if defined(SERIALDEBUG)
-		ZDebug.print("Z21 Eins(write) ");
-		ZDebug.print("RstP(s): ");
-		ZDebug.print(packet[4]);
-		ZDebug.print(", RstP(f): ");
-		ZDebug.print(packet[5]);
-		ZDebug.print(", ProgP: ");
-		ZDebug.print(packet[6]);
-		ZDebug.print(", MainV: ");
-		ZDebug.print(word(packet[17], packet[16]));
-		ZDebug.print(", ProgV: ");
-		ZDebug.print(word(packet[19], packet[18]));
-		ZDebug.println();
-#endif
 		for (byte i = 0; i < 16; i++)
 		{
 			FSTORAGE.FSTORAGEMODE(CONF2STORE + i, packet[4 + i]);
@@ -569,37 +732,29 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 			notifyz21UpdateConf();
 		break;
 	}
-	default:
-#if defined(SERIALDEBUG)
-		ZDebug.print("UNKNOWN_COMMAND");
-		//	for (byte i = 0; i < packet[0]; i++) {
-		//		ZDebug.print(" 0x");
-		//		ZDebug.print(packet[i], HEX);
-		//	}
-		ZDebug.println();
 #endif
+#if defined(z21Stats)
+	case z21hStats:
+	{ //page DB0 with 4 counters (32 Bit, little endian)
+		if (packet[4] > 3)
+			break;
+		byte stats[17];
+		stats[0] = packet[4];
+		for (byte i = 0; i < 4; i++)
+		{
+			unsigned long value = getStatsValue(packet[4], i);
+			for (byte b = 0; b < 4; b++)
+				stats[1 + i * 4 + b] = (value >> (b * 8)) & 0xFF;
+		}
+		EthSend(client, 0x15, packet[2], stats, false, Z21bcNone);
+		break;
+	}
+#endif
+	case z21hUnknown:
 		data[0] = 0x61;
 		data[1] = 0x82;
 		EthSend(client, 0x07, LAN_X_Header, data, true, Z21bcNone);
-	}
-	//---------------------------------------------------------------------------------------
-	//check if IP is still used:
-	unsigned long currentMillis = millis();
-	if ((currentMillis - z21IPpreviousMillis) > z21IPinterval)
-	{
-		z21IPpreviousMillis = currentMillis;
-		for (byte i = 0; i < z21clientMAX; i++)
-		{
-			if (ActIP[i].time > 0)
-			{
-				ActIP[i].time--; //Zeit herrunterrechnen
-			}
-			else
-			{
-				clearIP(i); //clear IP DATA
-										//send MESSAGE clear Client
-			}
-		}
+		break;
 	}
 }
 
@@ -607,6 +762,8 @@ void z21Class::receive(uint8_t client, uint8_t *packet)
 //Zustand der Gleisversorgung setzten
 void z21Class::setPower(byte state)
 {
+	if (z21SizeError)
+		return;
 	byte data[] = {LAN_X_BC_TRACK_POWER, 0x00};
 	Railpower = state;
 	switch (state)
@@ -628,11 +785,10 @@ void z21Class::setPower(byte state)
 		data[1] = 0x00;
 		break;
 	}
-	EthSend(0, 0x07, LAN_X_Header, data, true, Z21bcAll_s);
-#if defined(SERIALDEBUG)
-	ZDebug.print("set_X_BC_TRACK_POWER ");
-	ZDebug.println(state, HEX);
+#if defined(z21Trace)
+	trace(z21TracePower, 0, LAN_X_Header, data[0], state, 0x07);
 #endif
+	EthSend(0, 0x07, LAN_X_Header, data, true, Z21bcAll_s);
 }
 
 //--------------------------------------------------------------------------------------------
@@ -659,76 +815,93 @@ void z21Class::setCVPOMBYTE(uint16_t CVAdr, uint8_t value)
 //Gibt aktuellen Lokstatus an Anfragenden Zur�ck
 void z21Class::setLocoStateFull(int Adr, byte steps, byte speed, byte F0, byte F1, byte F2, byte F3, bool bc)
 {
-	byte data[9];
-	data[0] = LAN_X_LOCO_INFO; //0xEF X-HEADER
-	data[1] = (Adr >> 8) & 0x3F;
-	data[2] = Adr & 0xFF;
-	// Fahrstufeninformation: 0=14, 2=28, 4=128
-	if (steps & 0x03 == DCCSTEP14)
-		data[3] = 0; // 14 steps
-	if (steps & 0x03 == DCCSTEP28)
-		data[3] = 2; // 28 steps
-	if (steps & 0x03 == DCCSTEP128)
-		data[3] = 4;																													// 128 steps
-	data[4] = speed;																												//DSSS SSSS
-	data[5] = F0;																														//F0, F4, F3, F2, F1
-	data[6] = F1;																														//F5 - F12; Funktion F5 ist bit0 (LSB)
-	data[7] = F2;																														//F13-F20
-	data[8] = F3;																														//F21-F28
+	if (z21SizeError)
+		return;
+	TypeLocoState *loco = getLocoState(Adr, true); //remember for the next request
+	loco->steps = steps & 0x03;
+	loco->speed = speed;
+	loco->F[0] = F0;
+	loco->F[1] = F1;
+	loco->F[2] = F2;
+	loco->F[3] = F3;
+	loco->complete = true;
+	loco->changed = loco->changed && !bc;
 	if (bc)																																	//BC?
-		EthSend(0, 14, LAN_X_Header, data, true, Z21bcAll_s | Z21bcNetAll_s); //Send Power und Funktions to all active Apps
+		sendLocoInfo(0, loco, Z21bcAll_s | Z21bcNetAll_s); //Send Power und Funktions to all active Apps
 	else
-		EthSend(0, 14, LAN_X_Header, data, true, Z21bcNone); //Send Power und Funktions to request App
+		sendLocoInfo(0, loco, Z21bcNone); //Send Power und Funktions to request App
 }
 
 //--------------------------------------------------------------------------------------------
-//return state of S88 sensors
+//return state of S88 sensors, only the groups of 10 modules that changed since the last call
 void z21Class::setS88Data(byte *data, byte modules)
 {
-	// split data into 11 bytes blocks (1 packet address + 10 data)
-	byte MAdr = 1;		 // module number in packet
-	byte datasend[11]; // array holding the data to be sent (1 packet address + 10 modules data)
-	datasend[0] = 0;	 // fisrt byte is the packet address
-	for (byte m = 0; m < modules; m++)
+	if (z21SizeError)
+		return;
+	bool all = (modules != S88ModulesSend); //number of modules changed, send all
+	S88ModulesSend = modules;
+	S88Modules = (modules < z21S88MAX) ? modules : z21S88MAX;
+	for (byte group = 0; group * 10 < modules; group++)
 	{
-		datasend[MAdr] = data[m];
-		MAdr++;
-		// check if we have filled the data buffer and send it
-		if (MAdr >= 11)
-		{
-			EthSend(0, 0x0F, LAN_RMBUS_DATACHANGED, datasend, false, Z21bcRBus_s); //RMBUS_DATACHANED
-			MAdr = 1;																															 // reset the module number in packet
-			datasend[0]++;																												 //increment the next packet's address
+		byte first = group * 10;
+		byte count = (modules - first < 10) ? modules - first : 10;
+		if (first + count > z21S88MAX)
+		{ //not inside the stored state
+			if (first < z21S88MAX)
+				memcpy(&S88State[first], &data[first], z21S88MAX - first);
+			sendS88Group(0, group, data, modules, Z21bcRBus_s);
 		}
-	}
-	if (MAdr < 11 && MAdr > 1) // if we still have a partial packet, fill it with 0 and send
-	{
-		while (MAdr < 11)
+		else if (all || memcmp(&S88State[first], &data[first], count) != 0)
 		{
-			datasend[MAdr] = 0x00; // 0 values
-			MAdr++;								 // next module address
+			memcpy(&S88State[first], &data[first], count);
+			sendS88Group(0, group, data, modules, Z21bcRBus_s);
 		}
-		EthSend(0, 0x0F, LAN_RMBUS_DATACHANGED, datasend, false, Z21bcRBus_s); //RMBUS_DATACHANED
 	}
 }
 
+//--------------------------------------------------------------------------------------------
+//return state of all S88 sensors
+void z21Class::setS88DataFull(byte *data, byte modules)
+{
+	S88ModulesSend = 0xFF; //force to send all groups
+	setS88Data(data, modules);
+}
+
+#if z21LocoNet
 //--------------------------------------------------------------------------------------------
 //return state from LN detector
-void z21Class::setLNDetector(byte *data, byte DataLen)
+void z21Class::setLNDetector(const byte *data, byte DataLen)
 {
-	EthSend(0, 0x04 + DataLen, LAN_LOCONET_DETECTOR, data, false, Z21bcLocoNetGBM_s); //LAN_LOCONET_DETECTOR
+	EthSendLN(LAN_LOCONET_DETECTOR, data, DataLen, Z21bcLocoNetGBM_s); //LAN_LOCONET_DETECTOR
 }
 
 //--------------------------------------------------------------------------------------------
 //LN Meldungen weiterleiten
-void z21Class::setLNMessage(byte *data, byte DataLen, byte bcType, bool TX)
+void z21Class::setLNMessage(const byte *data, byte DataLen, byte bcType, bool TX)
 {
-	if (TX)																																 //Send by Z21 or Receive a Packet?
-		EthSend(0, 0x04 + DataLen, LAN_LOCONET_Z21_TX, data, false, bcType); //LAN_LOCONET_Z21_TX
+	if (TX) //Send by Z21 or Receive a Packet?
+		EthSendLN(LAN_LOCONET_Z21_TX, data, DataLen, bcType); //LAN_LOCONET_Z21_TX
 	else
-		EthSend(0, 0x04 + DataLen, LAN_LOCONET_Z21_RX, data, false, bcType); //LAN_LOCONET_Z21_RX
+		EthSendLN(LAN_LOCONET_Z21_RX, data, DataLen, bcType); //LAN_LOCONET_Z21_RX
 }
 
+//--------------------------------------------------------------------------------------------
+//LN message behind the header, the data is not copied
+void z21Class::EthSendLN(unsigned int Header, const byte *data, byte DataLen, unsigned long BC)
+{
+	if (DataLen > z21LNMAX)
+		return; //no LocoNet message
+	byte head[4];
+	head[0] = 0x04 + DataLen;
+	head[1] = 0;
+	head[2] = Header & 0xFF;
+	head[3] = Header >> 8;
+	TypeSpan span[2] = {{head, 4}, {data, DataLen}};
+	EthSendFrame(0, span, 2, BC);
+}
+#endif
+
+#if z21CAN
 //--------------------------------------------------------------------------------------------
 //return state from CAN detector
 void z21Class::setCANDetector(uint16_t NID, uint16_t Adr, uint8_t port, uint8_t typ, uint16_t v1, uint16_t v2)
@@ -746,6 +919,7 @@ void z21Class::setCANDetector(uint16_t NID, uint16_t Adr, uint8_t port, uint8_t
 	data[9] = v2 >> 8;
 	EthSend(0, 0x0E, LAN_CAN_DETECTOR, data, false, Z21bcCANDetector_s); //CAN_DETECTOR
 }
+#endif
 
 //--------------------------------------------------------------------------------------------
 //Return the state of accessory
@@ -833,163 +1007,1315 @@ void z21Class::sendSystemInfo(byte client, uint16_t maincurrent, uint16_t mainvo
 	EthSend(0, 0x14, LAN_SYSTEMSTATE_DATACHANGED, data, false, Z21bcSystemInfo_s); //all that select this message (Abo)
 }
 
-// Private Methods ///////////////////////////////////////////////////////////////////////////////////////////////////
-// Functions only available to other functions in this library *******************************************************
-
 //--------------------------------------------------------------------------------------------
-void z21Class::EthSend(byte client, unsigned int DataLen, unsigned int Header, byte *dataString, boolean withXOR, byte BC)
+//send all collected frames
+void z21Class::flush()
 {
-	byte data[24]; //z21 send storage
-	byte clientOut = client;
-
-	for (byte i = 0; i < z21clientMAX; i++)
+	if (z21SizeError)
+		return;
+#if defined(z21TxRetry)
+	//a waiting stop or power off for all clients goes before the frames of each client
+	if (!retryTx(z21clientMAX, z21PrioHigh))
+		return;
+#endif
+#if defined(z21TxBuffer)
+	//in the order of the first collected frame of each slot, so a client get the datagrams
+	//(own answers and frames for all) in the order the frames were send
+	uint16_t n = 0;
+	for (uint16_t i = 0; i < TxOrderLen; i++)
 	{
-		if ((BC == 0) || (BC == Z21bcAll_s) || ((ActIP[i].time > 0) && ((BC & ActIP[i].BCFlag) > 0)))
-		{ //Boradcast & Noch aktiv
-
-			if (BC != 0)
-			{
-				if (BC == Z21bcAll_s)
-					clientOut = 0; //ALL
-				else
-					clientOut = ActIP[i].client;
-			}
-			//--------------------------------------------
-
-			data[0] = DataLen & 0xFF;
-			data[1] = DataLen >> 8;
-			data[2] = Header & 0xFF;
-			data[3] = Header >> 8;
-			data[DataLen - 1] = 0; //XOR
-
-			for (byte i = 0; i < (DataLen - 5 + !withXOR); i++)
-			{ //Ohne Length und Header und XOR
-				if (withXOR)
-					data[DataLen - 1] = data[DataLen - 1] ^ *dataString;
-				//Udp->write(*dataString);
-				data[i + 4] = *dataString;
-				dataString++;
-			}
-			//--------------------------------------------
-			//Udp->endPacket();
-			if (notifyz21EthSend)
-				notifyz21EthSend(clientOut, data); //, DataLen);
-
-#if defined(SERIALDEBUG)
-			ZDebug.print("ETX ");
-			ZDebug.print(clientOut);
-			ZDebug.print(" BC:");
-			ZDebug.print(BC & ActIP[i].BCFlag, BIN);
-			ZDebug.print(" : ");
-			for (byte i = 0; i < data[0]; i++)
-			{
-				ZDebug.print(data[i], HEX);
-				ZDebug.print(" ");
-			}
-			ZDebug.println();
+		byte pos = TxOrder[i];
+#if defined(z21TxRetry)
+		if (retryTx(pos))
 #endif
-
-			if (BC == 0 || (BC == Z21bcAll_s && clientOut == 0)) //END when no BC
-				return;
-		}
+			flushTx(pos);
+		if (TxBufferLen[pos] > 0)
+			TxOrder[n++] = pos; //transport still busy, keep the place
+	}
+	TxOrderLen = n;
+#endif
+#if defined(z21TxRetry)
+	for (int pos = 0; pos <= z21clientMAX; pos++)
+	{
+#if defined(z21TxBuffer)
+		if (TxBufferLen[pos] > 0)
+			continue; //transport still busy
+#endif
+		retryTx(pos);
 	}
+#endif
 }
 
+#if defined(z21SpeedQueue)
 //--------------------------------------------------------------------------------------------
-//Convert local stored flag back into a Z21 Flag
-unsigned long z21Class::getz21BcFlag(byte flag)
+//get the oldest waiting loco speed command, only the last speed of each loco is stored
+bool z21Class::pollLocoSpeed(uint16_t *Adr, uint8_t *speed, uint8_t *steps)
 {
-	unsigned long outFlag = 0;
-	if ((flag & Z21bcAll_s) != 0)
-		outFlag |= Z21bcAll;
-	if ((flag & Z21bcRBus_s) != 0)
-		outFlag |= Z21bcRBus;
-	if ((flag & Z21bcSystemInfo_s) != 0)
-		outFlag |= Z21bcSystemInfo;
-	if ((flag & Z21bcNetAll_s) != 0)
-		outFlag |= Z21bcNetAll;
-	if ((flag & Z21bcLocoNet_s) != 0)
-		outFlag |= Z21bcLocoNet;
-	if ((flag & Z21bcLocoNetLocos_s) != 0)
-		outFlag |= Z21bcLocoNetLocos;
-	if ((flag & Z21bcLocoNetSwitches_s) != 0)
-		outFlag |= Z21bcLocoNetSwitches;
-	if ((flag & Z21bcLocoNetGBM_s) != 0)
-		outFlag |= Z21bcLocoNetGBM;
-	return outFlag;
+	if (z21SizeError || SpeedQueueLen == 0)
+		return false;
+	*Adr = SpeedQueue[0].Adr;
+	*speed = SpeedQueue[0].speed;
+	*steps = SpeedQueue[0].steps;
+	SpeedQueueLen--;
+	memmove(&SpeedQueue[0], &SpeedQueue[1], SpeedQueueLen * sizeof(TypeLocoSpeed));
+	return true;
 }
+#endif
 
 //--------------------------------------------------------------------------------------------
-//Convert Z21 LAN BC flag to local stored flag
-byte z21Class::getLocalBcFlag(unsigned long flag)
-{
-	byte outFlag = 0;
-	if ((flag & Z21bcAll) != 0)
-		outFlag |= Z21bcAll_s;
-	if ((flag & Z21bcRBus) != 0)
-		outFlag |= Z21bcRBus_s;
-	if ((flag & Z21bcSystemInfo) != 0)
-		outFlag |= Z21bcSystemInfo_s;
-	if ((flag & Z21bcNetAll) != 0)
-		outFlag |= Z21bcNetAll_s;
-	if ((flag & Z21bcLocoNet) != 0)
-		outFlag |= Z21bcLocoNet_s;
-	if ((flag & Z21bcLocoNetLocos) != 0)
-		outFlag |= Z21bcLocoNetLocos_s;
-	if ((flag & Z21bcLocoNetSwitches) != 0)
-		outFlag |= Z21bcLocoNetSwitches_s;
-	if ((flag & Z21bcLocoNetGBM) != 0)
-		outFlag |= Z21bcLocoNetGBM_s;
-	return outFlag;
+//number of rejected messages (length or XOR wrong)
+unsigned long z21Class::getRxMalformed()
+{
+	return RxMalformed;
 }
 
 //--------------------------------------------------------------------------------------------
-// delete the stored IP-Address
-void z21Class::clearIP(byte pos)
+//number of frames the transport could not send
+unsigned long z21Class::getTxDropped()
 {
-	ActIP[pos].client = 0;
-	ActIP[pos].BCFlag = 0;
-	ActIP[pos].time = 0;
+	return TxDropped;
 }
 
 //--------------------------------------------------------------------------------------------
-void z21Class::clearIPSlots()
+//number of waiting state frames that a newer one replaced
+unsigned long z21Class::getTxSuperseded()
 {
-	for (int i = 0; i < z21clientMAX; i++)
-		clearIP(i);
+	return TxSuperseded;
 }
 
+#if defined(z21Stats)
 //--------------------------------------------------------------------------------------------
-void z21Class::clearIPSlot(byte client)
+//copy of the counters, with the active clients
+void z21Class::getStats(TypeStats *stats)
 {
-	for (int i = 0; i < z21clientMAX; i++)
+	if (z21SizeError)
 	{
-		if (ActIP[i].client == client)
+		memset(stats, 0, sizeof(TypeStats));
+		return;
+	}
+	memcpy(stats, &Stats, sizeof(TypeStats));
+	stats->rxUnknown = Stats.rxMessage[z21hUnknown];
+	stats->rxMalformed = RxMalformed;
+	stats->txDropped = TxDropped;
+	stats->txSuperseded = TxSuperseded;
+	stats->clients = 0;
+	for (byte i = 0; i < z21clientMAX; i++)
+	{
+		if (ActIP[i].time > 0)
+			stats->clients++;
+	}
+}
+
+//--------------------------------------------------------------------------------------------
+void z21Class::clearStats()
+{
+	if (z21SizeError)
+		return;
+	memset(&Stats, 0, sizeof(Stats));
+	RxMalformed = 0;
+	TxDropped = 0;
+	TxSuperseded = 0;
+}
+
+//--------------------------------------------------------------------------------------------
+//LAN header, X-Header and DB0 of a rxMessage counter
+bool z21Class::getStatsMessage(byte index, uint16_t *header, byte *xheader, byte *db0)
+{
+	if (index == z21hNone || index == z21hUnknown || index == z21hMalformed)
+		return false;
+	z21Dispatch entry;
+	for (byte pos = 0; pos < z21DispatchCount; pos++)
+	{
+		memcpy_P(&entry, &z21DispatchTable[pos], sizeof(z21Dispatch));
+		if (entry.handler == index)
+		{
+			*header = entry.header;
+			*xheader = entry.xheader;
+			*db0 = (entry.flags & z21DispatchDB0) ? entry.db0 : 0;
+			return true;
+		}
+	}
+	return false;
+}
+#endif
+
+#if defined(z21Trace)
+//--------------------------------------------------------------------------------------------
+//take the oldest trace records out of the ring, return the number of records
+byte z21Class::getTrace(TypeTrace *record, byte max)
+{
+	if (z21SizeError)
+		return 0;
+	byte n = 0;
+	while (n < max && TraceLen > 0)
+	{
+		record[n++] = Trace[TraceFirst];
+		TraceFirst = (TraceFirst + 1) % z21Trace;
+		TraceLen--;
+	}
+	return n;
+}
+
+//--------------------------------------------------------------------------------------------
+//number of trace records that where overwritten before they were read
+unsigned long z21Class::getTraceLost()
+{
+	return TraceLost;
+}
+
+//--------------------------------------------------------------------------------------------
+//store a trace record, when the ring is full the oldest one is overwritten
+void z21Class::trace(byte event, byte client, byte header, byte xheader, byte db0, uint16_t length)
+{
+	byte pos = (TraceFirst + TraceLen) % z21Trace;
+	if (TraceLen < z21Trace)
+		TraceLen++;
+	else
+	{
+		TraceFirst = (TraceFirst + 1) % z21Trace;
+		TraceLost++;
+	}
+	Trace[pos].time = z21TraceTime();
+	Trace[pos].event = event;
+	Trace[pos].client = client;
+	Trace[pos].header = header;
+	Trace[pos].xheader = xheader;
+	Trace[pos].db0 = db0;
+	Trace[pos].length = length;
+}
+
+#if defined(ZDebug)
+//--------------------------------------------------------------------------------------------
+//print and empty the trace ring, one line for each record:
+//time event client header X-Header DB0 length
+void z21Class::dumpTrace()
+{
+	if (z21SizeError)
+		return;
+	TypeTrace record;
+	while (getTrace(&record, 1) > 0)
+	{
+		ZDebug.print(record.time);
+		switch (record.event)
 		{
-			clearIP(i);
+		case z21TraceRX:
+			ZDebug.print(" RX ");
+			break;
+		case z21TraceTX:
+			ZDebug.print(" TX ");
+			break;
+		case z21TraceBad:
+			ZDebug.print(" BAD ");
+			break;
+		case z21TraceUnknown:
+			ZDebug.print(" UNKNOWN ");
+			break;
+		case z21TraceLogon:
+			ZDebug.print(" LOGON ");
+			break;
+		case z21TraceLogoff:
+			ZDebug.print(" LOGOFF ");
+			break;
+		case z21TracePower:
+			ZDebug.print(" POWER ");
+			break;
+		}
+		ZDebug.print(record.client);
+		ZDebug.print(" ");
+		ZDebug.print(record.header, HEX);
+		ZDebug.print(" ");
+		ZDebug.print(record.xheader, HEX);
+		ZDebug.print(" ");
+		ZDebug.print(record.db0, HEX);
+		ZDebug.print(" ");
+		ZDebug.println(record.length);
+	}
+	if (TraceLost > 0)
+	{
+		ZDebug.print("trace lost ");
+		ZDebug.println(TraceLost);
+	}
+}
+#endif
+#endif
+
+//--------------------------------------------------------------------------------------------
+//time from the last stop or power off command until the answer was send (micro seconds)
+unsigned long z21Class::getStopLatency()
+{
+	return StopLatency;
+}
+
+//--------------------------------------------------------------------------------------------
+//worst time from a stop or power off command until the answer was send (micro seconds)
+unsigned long z21Class::getStopLatencyMax()
+{
+	return StopLatencyMax;
+}
+
+// Private Methods ///////////////////////////////////////////////////////////////////////////////////////////////////
+// Functions only available to other functions in this library *******************************************************
+
+#if defined(z21Stats)
+//--------------------------------------------------------------------------------------------
+//add the time since start to a log2 histogram
+void z21Class::countTime(unsigned long *bins, unsigned long start)
+{
+	bins[z21StatsBin((uint32_t)(micros() - start), z21StatsBins)]++;
+}
+
+//--------------------------------------------------------------------------------------------
+//counter i of a page of the LAN query:
+//0: datagrams, messages, unknown, malformed
+//1: answers, to all, BC frames, dropped
+//2: logon, logoff, full, active clients
+//3: receive() 50% and 99%, send 50% and 99% below this time in us
+unsigned long z21Class::getStatsValue(byte page, byte i)
+{
+	unsigned long value = 0;
+	byte n;
+	switch ((page << 2) | i)
+	{
+	case 0x00:
+		return Stats.rxDatagrams;
+	case 0x01:
+		for (n = 0; n < z21hCount; n++)
+			value += Stats.rxMessage[n];
+		return value;
+	case 0x02:
+		return Stats.rxMessage[z21hUnknown];
+	case 0x03:
+		return RxMalformed;
+	case 0x04:
+		return Stats.txAnswer;
+	case 0x05:
+		return Stats.txAll;
+	case 0x06:
+		for (n = 0; n < z21bcLocalBits; n++)
+			value += Stats.txBC[n];
+		return value;
+	case 0x07:
+		return TxDropped;
+	case 0x08:
+		return Stats.logon;
+	case 0x09:
+		return Stats.logoff;
+	case 0x0A:
+		return Stats.full;
+	case 0x0B:
+		for (n = 0; n < z21clientMAX; n++)
+		{
+			if (ActIP[n].time > 0)
+				value++;
+		}
+		return value;
+	}
+	//percentile of a histogram
+	unsigned long *bins = (i < 2) ? Stats.receiveTime : Stats.sendTime;
+	unsigned long all = 0;
+	for (n = 0; n < z21StatsBins; n++)
+		all += bins[n];
+	unsigned long limit = (i & 0x01) ? all - all / 100 : all / 2;
+	for (n = 0; n < z21StatsBins - 1; n++)
+	{
+		value += bins[n];
+		if (value >= limit)
+			return (1UL << n) - 1; //upper end of the bin
+	}
+	return 0xFFFFFFFF; //last bin: more
+}
+#endif
+
+//--------------------------------------------------------------------------------------------
+//search the handler of a message inside z21DispatchTable and check length and XOR
+byte z21Class::getHandler(uint8_t *packet)
+{
+	uint16_t DataLen = word(packet[1], packet[0]);
+	byte header = packet[2];
+	byte xheader = 0;
+	if (packet[3] != 0)
+		return z21hUnknown;
+	if (header == LAN_X_Header)
+	{
+		if (DataLen < 6)
+		{
+			return z21hMalformed;
+		}
+		xheader = packet[4];
+	}
+	//first entry with this header and X-Header
+	byte pos = 0;
+	byte end = z21DispatchCount;
+	while (pos < end)
+	{
+		byte mid = (pos + end) / 2;
+		if (word(pgm_read_byte(&z21DispatchTable[mid].header), pgm_read_byte(&z21DispatchTable[mid].xheader)) < word(header, xheader))
+			pos = mid + 1;
+		else
+			end = mid;
+	}
+	z21Dispatch entry;
+	z21Dispatch found;
+	found.handler = (header == LAN_X_Header) ? z21hNone : z21hUnknown;
+	found.flags = 0;
+	found.minLen = 0;
+	found.maxLen = 0;
+	for (; pos < z21DispatchCount; pos++)
+	{
+		memcpy_P(&entry, &z21DispatchTable[pos], sizeof(z21Dispatch));
+		if (entry.header != header || entry.xheader != xheader)
+			break;
+		if ((entry.flags & z21DispatchDB0) == 0)
+		{ //any DB0, but a matching DB0 wins
+			found = entry;
+		}
+		else if (entry.db0 == packet[5])
+		{
+			found = entry;
+			break;
+		}
+	}
+	if (DataLen < found.minLen || (found.maxLen != 0 && DataLen > found.maxLen))
+	{
+		return z21hMalformed;
+	}
+	if (found.flags & z21DispatchXOR)
+	{
+		byte xOR = 0;
+		for (uint16_t i = 4; i < DataLen - 1; i++)
+			xOR ^= packet[i];
+		if (xOR != packet[DataLen - 1])
+		{
+			return z21hMalformed;
+		}
+	}
+	return found.handler;
+}
+
+//--------------------------------------------------------------------------------------------
+//priority of a frame: stop, power off and short circuit are handled and send first
+byte z21Class::getPriority(byte *data, uint16_t DataLen)
+{
+	if (DataLen < 6 || word(data[3], data[2]) != LAN_X_Header)
+		return z21PrioNormal;
+	switch (data[4])
+	{ //X-Header
+	case LAN_X_SET_STOP:
+	case LAN_X_BC_STOPPED:
+		return z21PrioHigh;
+	case LAN_X_GET_SETTING:
+		if (data[5] == 0x80) //X_SET_TRACK_POWER_OFF
+			return z21PrioHigh;
+		break;
+	case LAN_X_BC_TRACK_POWER:
+		if (data[5] == 0x00 || data[5] == 0x08) //track power off, short circuit
+			return z21PrioHigh;
+		break;
+	}
+	return z21PrioNormal;
+}
+
+//--------------------------------------------------------------------------------------------
+//priority of an outgoing frame, the X-Header may be inside the second part
+byte z21Class::getPriority(const TypeSpan *span, byte count)
+{
+	byte data[6];
+	return getPriority(data, peekFrame(span, count, data, sizeof(data)));
+}
+
+//--------------------------------------------------------------------------------------------
+//copy the first bytes of a frame in parts, return the number of bytes
+byte z21Class::peekFrame(const TypeSpan *span, byte count, byte *data, byte max)
+{
+	byte len = 0;
+	for (byte s = 0; s < count && len < max; s++)
+	{
+		for (size_t i = 0; i < span[s].length && len < max; i++)
+			data[len++] = span[s].data[i];
+	}
+	return len;
+}
+
+//--------------------------------------------------------------------------------------------
+void z21Class::EthSend(byte client, unsigned int DataLen, unsigned int Header, byte *dataString, boolean withXOR, unsigned long BC, uint16_t LocoAdr)
+{
+	if (DataLen < (0x04u + withXOR))
+		return;
+	byte head[4]; //length and header
+	head[0] = DataLen & 0xFF;
+	head[1] = DataLen >> 8;
+	head[2] = Header & 0xFF;
+	head[3] = Header >> 8;
+	byte XOR = 0;
+	uint16_t len = DataLen - 4 - withXOR; //Ohne Length und Header und XOR
+	if (withXOR)
+	{
+		for (uint16_t i = 0; i < len; i++)
+			XOR = XOR ^ dataString[i];
+	}
+	//the data stays where it is, only header and XOR are new
+	TypeSpan span[3] = {{head, 4}, {dataString, len}, {&XOR, 1}};
+	EthSendFrame(client, span, 2 + withXOR, BC, LocoAdr);
+}
+
+//--------------------------------------------------------------------------------------------
+//Send a frame to the client or all clients that select the BC
+//with a LocoAdr the Z21bcAll_s part only goes to the clients that subscribed this loco
+void z21Class::EthSendFrame(byte client, const TypeSpan *span, byte count, unsigned long BC, uint16_t LocoAdr)
+{
+	if (z21SizeError)
+		return;
+#if z21SendMAX > z21FrameMAX
+	byte *frame = SendFrame; //long LocoNet frame, not on the stack of receive()
+#else
+	byte frame[z21SendMAX]; //only used when the transport need the frame in one piece (z21FrameMAX Byte stack)
+#endif
+	TypeSpan one = {frame, 0};
+	if (count > 1 && !notifyz21EthSendv)
+	{ //build the frame only once for all clients
+		for (byte i = 0; i < count; i++)
+		{
+			if (one.length + span[i].length > z21SendMAX)
+				return; //does not fit into the send storage
+			memcpy(&frame[one.length], span[i].data, span[i].length);
+			one.length += span[i].length;
+		}
+		span = &one;
+		count = 1;
+	}
+#if defined(z21Stats)
+	unsigned long start = micros();
+#endif
+	byte prio = getPriority(span, count);
+	if (BC == 0)
+	{ //END when no BC
+		EthSendTo(client, span, count, prio);
+#if defined(z21Stats)
+		Stats.txAnswer++;
+		countTime(Stats.sendTime, start);
+#endif
+		return;
+	}
+	if (BC == Z21bcAll_s)
+	{
+		EthSendTo(0, span, count, prio); //ALL
+#if defined(z21Stats)
+		Stats.txAll++;
+		countTime(Stats.sendTime, start);
+#endif
+		return;
+	}
+#if defined(z21Stats)
+	byte clients = 0;
+#endif
+	//only visit the slots that subscribed one of the BC flags
+	for (byte b = 0; b < z21SlotBytes; b++)
+	{
+		byte slots = 0;
+		byte locoSlots = 0; //need a loco subscription
+		for (byte f = 0; f < z21bcLocalBits; f++)
+		{
+			if (bitRead(BC, f))
+			{
+				if (LocoAdr != z21LocoNone && (1UL << f) == Z21bcAll_s)
+					locoSlots |= BCSlots[f][b];
+				else
+					slots |= BCSlots[f][b];
+			}
+		}
+		locoSlots &= ~slots;
+		slots |= locoSlots;
+		for (byte i = b * 8; slots != 0; i++, slots >>= 1, locoSlots >>= 1)
+		{
+			if ((slots & 0x01) && (ActIP[i].time > 0)) //Boradcast & Noch aktiv
+			{
+				if (!(locoSlots & 0x01) || findLocoSub(i, LocoAdr) < z21LocoSubMAX)
+				{
+					EthSendTo(ActIP[i].client, span, count, prio);
+#if defined(z21Stats)
+					clients++;
+#endif
+				}
+			}
+		}
+	}
+#if defined(z21Stats)
+	for (byte f = 0; f < z21bcLocalBits; f++)
+	{
+		if (bitRead(BC, f))
+		{ //lowest BC flag
+			Stats.txBC[f] += clients;
+			break;
+		}
+	}
+	Stats.fanOut[z21StatsBin(clients, z21StatsFanOut)]++;
+	countTime(Stats.sendTime, start);
+#endif
+}
+
+//--------------------------------------------------------------------------------------------
+void z21Class::EthSendTo(byte client, const TypeSpan *span, byte count, byte prio)
+{
+#if defined(z21Trace)
+	byte head[6] = {0};
+	peekFrame(span, count, head, sizeof(head));
+	trace(z21TraceTX, client, head[2], (head[2] == LAN_X_Header) ? head[4] : 0, (head[2] == LAN_X_Header) ? head[5] : head[4], word(head[1], head[0]));
+#endif
+#if defined(z21Capture)
+	capture(client, InReceive ? z21CaptureTX : z21CaptureTXAPI, span, count);
+#endif
+
+	if (prio == z21PrioHigh)
+	{ //never wait behind collected frames
+		if (StopPending)
+		{
+			StopPending = false;
+			StopLatency = (uint32_t)(micros() - StopMicros);
+			if (StopLatency > StopLatencyMax)
+				StopLatencyMax = StopLatency;
+		}
+#if defined(z21TxBuffer)
+		//an older track power state must not follow
+		unsigned long key = getStateKey(span, count);
+		byte pos = z21clientMAX; //client 0 = all
+		if (client != 0)
+			pos = findIPSlot(client);
+		if (key != 0 && (client == 0 || pos < z21clientMAX))
+			dropTx(pos, key);
+#endif
+		EthSendDirect(client, span, count, prio);
+		return;
+	}
+#if defined(z21TxBuffer)
+	if (notifyz21EthSendData || notifyz21EthSendv)
+	{ //collect the frames of a client
+		size_t DataLen = 0;
+		for (byte s = 0; s < count; s++)
+			DataLen += span[s].length;
+		byte pos = z21clientMAX; //client 0 = all
+		if (client != 0)
+			pos = findIPSlot(client);
+		if ((client == 0 || pos < z21clientMAX) && DataLen <= z21TxBuffer)
+		{
+			if (TxBufferLen[pos] + DataLen > z21TxBuffer)
+				flush(); //also the slots with older frames, keep the order
+			if (TxBufferLen[pos] + DataLen > z21TxBuffer)
+			{ //transport is busy, only a newer state can replace a waiting one
+				if (!replaceTx(TxBuffer[pos], TxBufferLen[pos], span, count, DataLen))
+					TxDropped++;
+				return;
+			}
+			if (TxBufferLen[pos] == 0)
+				TxOrder[TxOrderLen++] = pos;
+			for (byte s = 0; s < count; s++)
+			{
+				memcpy(&TxBuffer[pos][TxBufferLen[pos]], span[s].data, span[s].length);
+				TxBufferLen[pos] += span[s].length;
+			}
 			return;
 		}
 	}
+#endif
+	EthSendDirect(client, span, count, prio);
 }
 
 //--------------------------------------------------------------------------------------------
-byte z21Class::addIPToSlot(byte client, byte BCFlag)
+//send without collecting, keep the frame when the transport is busy (z21TxRetry)
+void z21Class::EthSendDirect(byte client, const TypeSpan *span, byte count, byte prio)
 {
-	byte Slot = z21clientMAX;
+#if defined(z21TxRetry)
+	byte pos = z21clientMAX; //client 0 = all
+	if (client != 0)
+		pos = findIPSlot(client);
+	if (client == 0 || pos < z21clientMAX)
+	{
+		//waiting frames first, only stop and power off pass them
+		//and a waiting stop or power off for all clients
+		if ((prio == z21PrioHigh || ((pos == z21clientMAX || retryTx(z21clientMAX, z21PrioHigh)) && retryTx(pos))) && EthTransport(client, span, count))
+		{
+			if (prio == z21PrioHigh)
+				dropRetry(pos, getStateKey(span, count)); //an older track power state must not follow
+			return;
+		}
+		keepTx(pos, span, count, prio);
+		return;
+	}
+#endif
+	if (EthTransport(client, span, count))
+		return;
+#if defined(z21TxBuffer) && !defined(z21TxRetry)
+	if (prio == z21PrioHigh && (notifyz21EthSendData || notifyz21EthSendv))
+	{ //stop and power off are never dropped, they go first with the next flush()
+		byte pos = z21clientMAX; //client 0 = all
+		if (client != 0)
+			pos = findIPSlot(client);
+		if (client == 0 || pos < z21clientMAX)
+		{
+			firstTx(pos, span, count);
+			return;
+		}
+	}
+#else
+	(void)prio; //only for z21TxBuffer
+#endif
+	TxDropped++;
+}
+
+#if defined(z21Capture)
+//--------------------------------------------------------------------------------------------
+//record: time (ms, 4 Byte), client, type, length (2 Byte), little endian, then the frame
+void z21Class::capture(byte client, byte type, const TypeSpan *span, byte count)
+{
+	if (!notifyz21Capture)
+		return;
+	unsigned long time = Clock();
+	size_t len = 0;
+	TypeSpan record[4];
+	for (byte s = 0; s < count && s < 3; s++)
+	{
+		record[s + 1] = span[s];
+		len += span[s].length;
+	}
+	byte head[z21CaptureHeader];
+	head[0] = time & 0xFF;
+	head[1] = (time >> 8) & 0xFF;
+	head[2] = (time >> 16) & 0xFF;
+	head[3] = time >> 24;
+	head[4] = client;
+	head[5] = type;
+	head[6] = len & 0xFF;
+	head[7] = len >> 8;
+	record[0].data = head;
+	record[0].length = z21CaptureHeader;
+	notifyz21Capture(record, ((count < 3) ? count : 3) + 1);
+}
+#endif
+
+//--------------------------------------------------------------------------------------------
+//hand data to the transport, count > 1 only when notifyz21EthSendv is there
+//false when the transport could not send
+bool z21Class::EthTransport(byte client, const TypeSpan *span, byte count)
+{
+	if (notifyz21EthSendv)
+		return notifyz21EthSendv(client, span, count);
+	if (notifyz21EthSendData)
+		return notifyz21EthSendData(client, span[0].data, span[0].length);
+	if (notifyz21EthSend)
+		notifyz21EthSend(client, (uint8_t *)span[0].data);
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------
+//key of a state frame, a newer frame with the same key replace an older one
+//0 = no state frame
+unsigned long z21Class::getStateKey(const TypeSpan *span, byte count)
+{
+	byte data[7];
+	byte len = peekFrame(span, count, data, sizeof(data));
+	if (len >= 5 && word(data[3], data[2]) == LAN_RMBUS_DATACHANGED)
+		return 0x03000000UL | data[4]; //S88 group
+	if (len < 6 || word(data[3], data[2]) != LAN_X_Header)
+		return 0;
+	if ((data[4] == LAN_X_BC_TRACK_POWER && (data[5] <= 0x02 || data[5] == 0x08)) || (data[4] == LAN_X_BC_STOPPED && data[5] == 0x00))
+		return 0x04000000UL; //track power, only the last one is valid
+	if (len < 7)
+		return 0;
+	if (data[4] == LAN_X_LOCO_INFO)
+		return 0x01000000UL | word(data[5] & 0x3F, data[6]);
+	if (data[4] == LAN_X_TURNOUT_INFO)
+		return 0x02000000UL | word(data[5], data[6]);
+	return 0;
+}
+
+//--------------------------------------------------------------------------------------------
+//replace a waiting state frame with the same key and length by the new one
+bool z21Class::replaceTx(byte *buf, uint16_t len, const TypeSpan *span, byte count, uint16_t DataLen)
+{
+	unsigned long key = getStateKey(span, count);
+	if (key == 0)
+		return false;
+	uint16_t i = 0;
+	while (i + 4 <= len)
+	{
+		uint16_t FrameLen = word(buf[i + 1], buf[i]);
+		if (FrameLen < 4 || i + FrameLen > len)
+			break;
+		TypeSpan old = {&buf[i], FrameLen};
+		if (FrameLen == DataLen && getStateKey(&old, 1) == key)
+		{
+			for (byte s = 0; s < count; s++)
+			{
+				memcpy(&buf[i], span[s].data, span[s].length);
+				i += span[s].length;
+			}
+			TxSuperseded++;
+			return true;
+		}
+		i += FrameLen;
+	}
+	return false;
+}
+
+#if defined(z21TxRetry)
+//--------------------------------------------------------------------------------------------
+//send the waiting frames of a slot, false when the transport is still busy
+//z21PrioHigh: only the stop and power off frames in front of the ring
+bool z21Class::retryTx(byte pos, byte prio)
+{
+	byte client = 0; //all
+	if (pos < z21clientMAX)
+		client = ActIP[pos].client;
+	while (TxRetryLen[pos] > 0)
+	{
+		byte *frame = TxRetry[pos][TxRetryFirst[pos]];
+		TypeSpan span = {frame, word(frame[1], frame[0])};
+		if (prio == z21PrioHigh && getPriority(frame, span.length) != z21PrioHigh)
+			break;
+		if (!EthTransport(client, &span, 1))
+			return false;
+		TxRetryFirst[pos] = (TxRetryFirst[pos] + 1) % z21TxRetry;
+		TxRetryLen[pos]--;
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------
+//remove the waiting state frames with this key
+void z21Class::dropRetry(byte pos, unsigned long key)
+{
+	if (key == 0)
+		return;
+	for (byte n = 0; n < TxRetryLen[pos];)
+	{
+		byte *old = TxRetry[pos][(TxRetryFirst[pos] + n) % z21TxRetry];
+		TypeSpan oldSpan = {old, word(old[1], old[0])};
+		if (getStateKey(&oldSpan, 1) == key)
+		{
+			removeRetry(pos, n);
+			TxSuperseded++;
+		}
+		else
+			n++;
+	}
+}
+
+//--------------------------------------------------------------------------------------------
+//remove the waiting frame n of a slot
+void z21Class::removeRetry(byte pos, byte n)
+{
+	for (; n + 1 < TxRetryLen[pos]; n++)
+		memcpy(TxRetry[pos][(TxRetryFirst[pos] + n) % z21TxRetry], TxRetry[pos][(TxRetryFirst[pos] + n + 1) % z21TxRetry], z21FrameMAX);
+	TxRetryLen[pos]--;
+}
+
+//--------------------------------------------------------------------------------------------
+//store a frame for the next try, a newer state replace the older one
+//when full the oldest state frame is dropped, otherwise the new frame;
+//stop and power off go first and replace the newest frame when only commands wait
+void z21Class::keepTx(byte pos, const TypeSpan *span, byte count, byte prio)
+{
+	byte frame[z21FrameMAX];
+	uint16_t len = 0;
+	for (byte s = 0; s < count; s++)
+	{
+		if (len + span[s].length > z21FrameMAX)
+		{ //too long to keep
+			TxDropped++;
+			return;
+		}
+		memcpy(&frame[len], span[s].data, span[s].length);
+		len += span[s].length;
+	}
+	TypeSpan one = {frame, len};
+	unsigned long key = getStateKey(&one, 1);
+	byte drop = z21TxRetry; //oldest state frame
+	for (byte n = 0; n < TxRetryLen[pos]; n++)
+	{
+		byte *old = TxRetry[pos][(TxRetryFirst[pos] + n) % z21TxRetry];
+		TypeSpan oldSpan = {old, word(old[1], old[0])};
+		unsigned long oldKey = getStateKey(&oldSpan, 1);
+		if (key != 0 && oldKey == key)
+		{
+			TxSuperseded++;
+			if (prio != z21PrioHigh)
+			{
+				memcpy(old, frame, len);
+				return;
+			}
+			removeRetry(pos, n); //goes to the front
+			break;
+		}
+		if (oldKey != 0 && drop == z21TxRetry)
+			drop = n;
+	}
+	if (TxRetryLen[pos] == z21TxRetry)
+	{
+		if (drop == z21TxRetry)
+		{ //only commands are waiting
+			if (prio != z21PrioHigh)
+			{
+				TxDropped++;
+				return;
+			}
+			drop = TxRetryLen[pos] - 1;
+		}
+		TxDropped++;
+		removeRetry(pos, drop);
+	}
+	if (prio == z21PrioHigh)
+	{ //stop and power off go first
+		TxRetryFirst[pos] = (TxRetryFirst[pos] + z21TxRetry - 1) % z21TxRetry;
+		memcpy(TxRetry[pos][TxRetryFirst[pos]], frame, len);
+	}
+	else
+		memcpy(TxRetry[pos][(TxRetryFirst[pos] + TxRetryLen[pos]) % z21TxRetry], frame, len);
+	TxRetryLen[pos]++;
+}
+#endif
+
+#if defined(z21TxBuffer)
+//--------------------------------------------------------------------------------------------
+//remove the collected state frames with this key
+void z21Class::dropTx(byte pos, unsigned long key)
+{
+	byte *buf = TxBuffer[pos];
+	uint16_t i = 0;
+	while (i + 4 <= TxBufferLen[pos])
+	{
+		uint16_t FrameLen = word(buf[i + 1], buf[i]);
+		if (FrameLen < 4 || i + FrameLen > TxBufferLen[pos])
+			break;
+		TypeSpan old = {&buf[i], FrameLen};
+		if (getStateKey(&old, 1) == key)
+		{
+			memmove(&buf[i], &buf[i + FrameLen], TxBufferLen[pos] - i - FrameLen);
+			TxBufferLen[pos] -= FrameLen;
+			TxSuperseded++;
+		}
+		else
+			i += FrameLen;
+	}
+	if (TxBufferLen[pos] == 0)
+		unorderTx(pos);
+}
+
+//--------------------------------------------------------------------------------------------
+//put a stop or power off the transport could not send in front of the collected frames,
+//the slot is flushed first; collected frames at the end make room when needed
+void z21Class::firstTx(byte pos, const TypeSpan *span, byte count)
+{
+	uint16_t DataLen = 0;
+	for (byte s = 0; s < count; s++)
+		DataLen += span[s].length;
+	if (DataLen > z21TxBuffer)
+	{
+		TxDropped++;
+		return;
+	}
+	byte *buf = TxBuffer[pos];
+	uint16_t keep = 0; //collected frames that still fit
+	while (keep + 4 <= TxBufferLen[pos])
+	{
+		uint16_t FrameLen = word(buf[keep + 1], buf[keep]);
+		if (FrameLen < 4 || keep + FrameLen + DataLen > z21TxBuffer)
+			break;
+		keep += FrameLen;
+	}
+	if (keep < TxBufferLen[pos])
+		TxDropped++; //the newest collected frames
+	if (TxBufferLen[pos] > 0)
+		unorderTx(pos);
+	memmove(&buf[DataLen], buf, keep);
+	for (byte s = 0; s < count; s++)
+	{
+		memcpy(buf, span[s].data, span[s].length);
+		buf += span[s].length;
+	}
+	TxBufferLen[pos] = keep + DataLen;
+	memmove(&TxOrder[1], TxOrder, TxOrderLen);
+	TxOrder[0] = pos;
+	TxOrderLen++;
+}
+
+//--------------------------------------------------------------------------------------------
+//remove the slot from the flush order
+void z21Class::unorderTx(byte pos)
+{
+	for (uint16_t i = 0; i < TxOrderLen; i++)
+	{
+		if (TxOrder[i] == pos)
+		{
+			TxOrderLen--;
+			memmove(&TxOrder[i], &TxOrder[i + 1], TxOrderLen - i);
+			return;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------
+//send the collected frames of a client as one UDP datagram
+void z21Class::flushTx(byte pos)
+{
+	if (TxBufferLen[pos] == 0)
+		return;
+	byte client = 0; //all
+	if (pos < z21clientMAX)
+		client = ActIP[pos].client;
+	TypeSpan span = {TxBuffer[pos], TxBufferLen[pos]};
+	if (EthTransport(client, &span, 1))
+		TxBufferLen[pos] = 0; //otherwise keep them for the next try
+}
+#endif
+
+//--------------------------------------------------------------------------------------------
+//Convert local stored flag back into a Z21 Flag
+unsigned long z21Class::getz21BcFlag(unsigned long flag)
+{
+	unsigned long outFlag = 0;
+	for (byte f = 0; f < z21bcLocalBits; f++)
+	{
+		if (bitRead(flag, f))
+			outFlag |= pgm_read_dword(&z21BcFlagTable[f]);
+	}
+	return outFlag;
+}
+
+//--------------------------------------------------------------------------------------------
+//Convert Z21 LAN BC flag to local stored flag
+unsigned long z21Class::getLocalBcFlag(unsigned long flag)
+{
+	unsigned long outFlag = 0;
+	for (byte f = 0; f < z21bcLocalBits; f++)
+	{
+		if ((flag & pgm_read_dword(&z21BcFlagTable[f])) != 0)
+			outFlag |= 1UL << f;
+	}
+	return outFlag;
+}
+
+//--------------------------------------------------------------------------------------------
+// delete the stored IP-Address
+void z21Class::clearIP(byte pos)
+{
+#if defined(z21Trace)
+	if (ActIP[pos].time > 0)
+		trace(z21TraceLogoff, ActIP[pos].client, 0, 0, pos, 0);
+#endif
+#if defined(z21Stats)
+	if (ActIP[pos].time > 0)
+		Stats.logoff++;
+#endif
+	setBcFlag(pos, 0);
+	memset(ActIP[pos].loco, 0xFF, sizeof(ActIP[pos].loco)); //z21LocoNone
+#if defined(z21TxBuffer)
+	if (TxBufferLen[pos] > 0)
+		unorderTx(pos);
+	TxBufferLen[pos] = 0; //client is gone
+#endif
+#if defined(z21TxRetry)
+	TxRetryLen[pos] = 0;
+#endif
+#if z21ClientIndex
+	if (ClientSlot[ActIP[pos].client] == pos)
+		ClientSlot[ActIP[pos].client] = z21clientMAX;
+#endif
+	unlinkIP(pos);
+	ActIP[pos].client = 0;
+}
+
+//--------------------------------------------------------------------------------------------
+//client is active, run out after z21ActTimeIP intervals
+void z21Class::linkIP(byte pos)
+{
+	unlinkIP(pos);
+	byte bucket = (WheelPos + z21ActTimeIP) % z21WheelSize;
+	ActIP[pos].time = bucket + 1;
+	WheelPrev[pos] = z21clientMAX;
+	WheelNext[pos] = WheelHead[bucket];
+	if (WheelHead[bucket] < z21clientMAX)
+		WheelPrev[WheelHead[bucket]] = pos;
+	WheelHead[bucket] = pos;
+}
+
+//--------------------------------------------------------------------------------------------
+//remove the client from the timer wheel
+void z21Class::unlinkIP(byte pos)
+{
+	if (ActIP[pos].time == 0)
+		return;
+	if (WheelPrev[pos] < z21clientMAX)
+		WheelNext[WheelPrev[pos]] = WheelNext[pos];
+	else
+		WheelHead[ActIP[pos].time - 1] = WheelNext[pos];
+	if (WheelNext[pos] < z21clientMAX)
+		WheelPrev[WheelNext[pos]] = WheelPrev[pos];
+	ActIP[pos].time = 0;
+}
+
+//--------------------------------------------------------------------------------------------
+void z21Class::clearIPSlots()
+{
+	memset(ActIP, 0, sizeof(ActIP));
 	for (byte i = 0; i < z21clientMAX; i++)
+		memset(ActIP[i].loco, 0xFF, sizeof(ActIP[i].loco)); //z21LocoNone
+	memset(WheelHead, z21clientMAX, sizeof(WheelHead));
+	WheelPos = 0;
+	memset(BCSlots, 0, sizeof(BCSlots));
+#if defined(z21TxBuffer)
+	memset(TxBufferLen, 0, sizeof(TxBufferLen));
+	TxOrderLen = 0;
+#endif
+#if defined(z21TxRetry)
+	memset(TxRetryFirst, 0, sizeof(TxRetryFirst));
+	memset(TxRetryLen, 0, sizeof(TxRetryLen));
+#endif
+#if z21ClientIndex
+	memset(ClientSlot, z21clientMAX, sizeof(ClientSlot));
+#endif
+}
+
+//--------------------------------------------------------------------------------------------
+void z21Class::clearIPSlot(byte client)
+{
+	byte Slot = findIPSlot(client);
+	if (Slot < z21clientMAX)
+		clearIP(Slot);
+}
+
+//--------------------------------------------------------------------------------------------
+byte z21Class::findIPSlot(byte client)
+{
+#if z21ClientIndex
+	return ClientSlot[client];
+#else
+	byte Slot = 0;
+	while (Slot < z21clientMAX && ActIP[Slot].client != client)
+		Slot++;
+	return Slot;
+#endif
+}
+
+//--------------------------------------------------------------------------------------------
+unsigned long z21Class::addIPToSlot(byte client, unsigned long BCFlag)
+{
+	byte Slot = findIPSlot(client);
+	if (Slot == z21clientMAX)
+	{ //new client, search a free slot
+		for (Slot = 0; Slot < z21clientMAX; Slot++)
+		{
+			if (ActIP[Slot].time == 0)
+				break;
+		}
+		if (Slot == z21clientMAX)
+		{ //all slots in use
+#if defined(z21Stats)
+			Stats.full++;
+#endif
+			return 0;
+		}
+		clearIP(Slot); //remove the client that was not active any more
+		ActIP[Slot].client = client;
+		linkIP(Slot);
+#if defined(z21Trace)
+		trace(z21TraceLogon, client, 0, 0, Slot, 0);
+#endif
+#if defined(z21Stats)
+		Stats.logon++;
+#endif
+#if z21ClientIndex
+		ClientSlot[client] = Slot;
+#endif
+		setPower(Railpower);
+	}
+	linkIP(Slot);
+	if (BCFlag != 0) //Falls BC Flag übertragen wurde diesen hinzufügen!
+		setBcFlag(Slot, BCFlag);
+	return ActIP[Slot].BCFlag; //BC Flag 4. Byte Rückmelden
+}
+
+//--------------------------------------------------------------------------------------------
+//store the BC flag of a slot and keep the subscriber index of each flag up to date
+void z21Class::setBcFlag(byte pos, unsigned long BCFlag)
+{
+	unsigned long changed = ActIP[pos].BCFlag ^ BCFlag;
+	ActIP[pos].BCFlag = BCFlag;
+	for (byte f = 0; f < z21bcLocalBits; f++)
+	{
+		if (bitRead(changed, f))
+			BCSlots[f][pos / 8] ^= 1 << (pos % 8);
+	}
+}
+
+//--------------------------------------------------------------------------------------------
+//search the stored state of a loco, add a new one when needed
+//the list is kept in the order of use (newest first), a new loco replaces the least recently used one
+TypeLocoState *z21Class::getLocoState(uint16_t Adr, bool add)
+{
+	byte i = 0;
+	while (i < z21LocoMAX && LocoState[i].Adr != Adr)
+		i++;
+	if (i == z21LocoMAX)
+	{
+		if (!add)
+			return NULL;
+		i = z21LocoMAX - 1;
+		while (i > 0 && LocoState[i].changed)
+			i--; //keep a state with a LAN_X_LOCO_INFO to send
+		if (LocoState[i].changed)
+			i = z21LocoMAX - 1;
+		memset(&LocoState[i], 0, sizeof(TypeLocoState));
+		LocoState[i].Adr = Adr;
+		LocoState[i].steps = DCCSTEP128;
+	}
+	if (i > 0)
+	{ //move to the front
+		TypeLocoState loco = LocoState[i];
+		memmove(&LocoState[1], &LocoState[0], i * sizeof(TypeLocoState));
+		LocoState[0] = loco;
+	}
+	return &LocoState[0];
+}
+
+//--------------------------------------------------------------------------------------------
+//change a function inside the stored loco state (type: 0=AUS, 1=EIN, 2=UM), return the new state
+//0xFF = not a function F0-F31 or unknown type
+byte z21Class::setLocoFkt(TypeLocoState *loco, byte type, byte fkt)
+{
+	byte pos;	//F0, F4, F3, F2, F1 / F5 - F12 / F13-F20 / F21-F28 / F29-F31
+	byte bit;
+	if (fkt == 0)
+	{
+		pos = 0;
+		bit = 4;
+	}
+	else if (fkt <= 4)
 	{
-		if (ActIP[i].client == client)
+		pos = 0;
+		bit = fkt - 1;
+	}
+	else if (fkt <= 31)
+	{
+		pos = (fkt + 3) / 8;
+		bit = (fkt + 3) % 8;
+	}
+	else
+		return 0xFF;
+	if (type == 0)
+		loco->F[pos] &= ~(1 << bit);
+	else if (type == 1)
+		loco->F[pos] |= 1 << bit;
+	else if (type == 2)
+		loco->F[pos] ^= 1 << bit;
+	else
+		return 0xFF;
+	loco->changed = true; //send LAN_X_LOCO_INFO after the datagram
+	return bitRead(loco->F[pos], bit);
+}
+
+//--------------------------------------------------------------------------------------------
+//send LAN_X_LOCO_INFO once for all locos that were changed by the last datagram
+void z21Class::sendLocoInfoChanged()
+{
+	for (byte i = 0; i < z21LocoMAX; i++)
+	{
+		if (LocoState[i].changed && LocoState[i].complete)
+		{ //speed and steps are known
+			LocoState[i].changed = false;
+			sendLocoInfo(0, &LocoState[i], Z21bcAll_s | Z21bcNetAll_s);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------
+//send LAN_X_LOCO_INFO with the stored loco state
+void z21Class::sendLocoInfo(byte client, TypeLocoState *loco, unsigned long BC)
+{
+	byte data[9];
+	data[0] = LAN_X_LOCO_INFO; //0xEF X-HEADER
+	data[1] = (loco->Adr >> 8) & 0x3F;
+	data[2] = loco->Adr & 0xFF;
+	// Fahrstufeninformation: 0=14, 2=28, 4=128
+	if (loco->steps == DCCSTEP28)
+		data[3] = 2; // 28 steps
+	else if (loco->steps == DCCSTEP128)
+		data[3] = 4; // 128 steps
+	else
+		data[3] = 0; // 14 steps
+	data[4] = loco->speed; //DSSS SSSS
+	data[5] = loco->F[0];	 //F0, F4, F3, F2, F1
+	data[6] = loco->F[1];	 //F5 - F12; Funktion F5 ist bit0 (LSB)
+	data[7] = loco->F[2];	 //F13-F20
+	data[8] = loco->F[3];	 //F21-F28
+	EthSend(client, 14, LAN_X_Header, data, true, BC, loco->Adr);
+}
+
+//--------------------------------------------------------------------------------------------
+//position of the loco inside the subscriptions of a slot, z21LocoSubMAX = not subscribed
+byte z21Class::findLocoSub(byte pos, uint16_t Adr)
+{
+	byte i = 0;
+	while (i < z21LocoSubMAX && ActIP[pos].loco[i] != Adr)
+		i++;
+	return i;
+}
+
+//--------------------------------------------------------------------------------------------
+//subscribe a loco for the client, the longest unused one is removed when the list is full
+//with z21LocoSubMAX 1 (AVR) a client only gets LAN_X_LOCO_INFO for the last loco it asked for
+void z21Class::addLocoSub(byte client, uint16_t Adr)
+{
+	byte pos = findIPSlot(client);
+	if (pos >= z21clientMAX)
+		return;
+	byte i = findLocoSub(pos, Adr);
+	if (i == z21LocoSubMAX)
+		i--;
+	for (; i > 0; i--)
+		ActIP[pos].loco[i] = ActIP[pos].loco[i - 1];
+	ActIP[pos].loco[0] = Adr; //newest first
+}
+
+//--------------------------------------------------------------------------------------------
+//send one group of 10 S88 modules
+void z21Class::sendS88Group(byte client, byte group, byte *data, byte modules, unsigned long BC)
+{
+	byte datasend[11]; // array holding the data to be sent (1 packet address + 10 modules data)
+	datasend[0] = group; // fisrt byte is the packet address
+	for (byte m = 0; m < 10; m++)
+	{
+		if (group * 10 + m < modules)
+			datasend[m + 1] = data[group * 10 + m];
+		else
+			datasend[m + 1] = 0x00; // 0 values
+	}
+	EthSend(client, 0x0F, LAN_RMBUS_DATACHANGED, datasend, false, BC); //RMBUS_DATACHANED
+}
+
+#if defined(z21SpeedQueue)
+//--------------------------------------------------------------------------------------------
+//store a loco speed command, overwrite the waiting one of the same loco
+//an emergency stop is not stored and removes the waiting command
+bool z21Class::addLocoSpeed(uint16_t Adr, byte speed, byte steps)
+{
+	byte i = 0;
+	while (i < SpeedQueueLen && SpeedQueue[i].Adr != Adr)
+		i++;
+	if ((speed & (steps == 128 ? 0x7F : 0x0F)) == 0x01)
+	{ //emergency stop
+		if (i < SpeedQueueLen)
 		{
-			ActIP[i].time = z21ActTimeIP;
-			if (BCFlag != 0) //Falls BC Flag �bertragen wurde diesen hinzuf�gen!
-				ActIP[i].BCFlag = BCFlag;
-			return ActIP[i].BCFlag; //BC Flag 4. Byte R�ckmelden
+			SpeedQueueLen--;
+			memmove(&SpeedQueue[i], &SpeedQueue[i + 1], (SpeedQueueLen - i) * sizeof(TypeLocoSpeed));
 		}
-		else if (ActIP[i].time == 0 && Slot == z21clientMAX)
-			Slot = i;
+		return false;
 	}
-	ActIP[Slot].client = client;
-	ActIP[Slot].time = z21ActTimeIP;
-	setPower(Railpower);
-	return ActIP[Slot].BCFlag; //BC Flag 4. Byte R�ckmelden
+	if (i == z21SpeedQueue)
+		return false; //full
+	if (i == SpeedQueueLen)
+		SpeedQueueLen++;
+	SpeedQueue[i].Adr = Adr;
+	SpeedQueue[i].speed = speed;
+	SpeedQueue[i].steps = steps;
+	return true;
 }
+#endif
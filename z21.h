@@ -25,6 +25,27 @@
 	- 19.06.17 add FW Version 1.28, 1.29 and 1.30
 	- 06.08.17 add support for Arduino DUE
 	- 27.08.17 fix speed step setting
+	- 17.10.26 parse all messages of a UDP datagram
+			   client capacity and features configurable at compile time
+			   store RailCom and CAN BC flags
+			   answer LAN_X_GET_LOCO_INFO from the stored loco state
+			   resolve loco function toggle inside the library
+			   LAN_X_LOCO_INFO only to clients that subscribed the loco
+			   send only changed S88 groups, answer LAN_RMBUS_GETDATA from the last state
+			   optional collect frames into one UDP datagram per client
+			   optional queue for loco speed commands, only the last one of each loco
+			   send stop and power off first
+			   table driven message dispatch with length and XOR check
+			   LocoNet messages up to 127 Byte, forward without copy
+			   send hooks with length (notifyz21EthSendData) and in parts (notifyz21EthSendv)
+			   send hooks report a busy transport, optional retry of the frames, drop counters
+			   tick() for the client timeout, only touch the clients that run out
+			   time source can be set with setClock()
+			   host build with CMake (extras/host) and a benchmark
+			   club layout load generator for the host build
+			   optional capture of all frames and a replay for the host build
+			   trace ring instead of the SERIALDEBUG prints
+			   optional counters per message, fan-out and clients, time histograms (z21Stats)
 */
 
 // include types & constants of Wiring core API
@@ -40,8 +61,15 @@
 #define z21Port 21105      // local port to listen on
 
 //**************************************************************
-//#define ZDebug Serial	//Port for the Debugging
-//#define SERIALDEBUG		//Serial Debug
+//#define ZDebug Serial	//Port for the Debugging, print the trace with dumpTrace()
+//#define SERIALDEBUG		//Serial Debug, same as z21Trace 32
+//#define z21Trace 32	//ring of the last events in RAM (records), read with getTrace() or dumpTrace()
+//#define z21TxBuffer 512	//collect the frames for each client into one UDP datagram (Byte per client), need notifyz21EthSendData or notifyz21EthSendv
+//#define z21TxRetry 4	//keep frames the transport could not send and try again (frames per client), need notifyz21EthSendData or notifyz21EthSendv
+//#define z21Capture	//record every received datagram and sent frame with notifyz21Capture, see extras/host/replay.cpp
+//#define z21SpeedQueue 8	//store the last loco speed command of each loco, read them with pollLocoSpeed()
+//#define z21Stats	//counters per message and time histograms (ca. 450 Byte RAM), read with getStats()
+//#define z21StatsHeader 0xF0	//answer a LAN query with this header (above 0xC4) with the counters of page DB0, need z21Stats
 
 //**************************************************************
 //Firmware-Version der Z21:
@@ -71,9 +99,125 @@ HwType: #define D_HWT_Z21_OLD 0x00000200 // �schwarze Z21� (Hardware-Variant
 #define csShortCircuit 0x04 // Kurzschluss
 #define csServiceMode 0x08 // Der Programmiermodus ist aktiv - Service Mode
 
-#define z21clientMAX 30        //Speichergr��e f�r IP-Adressen
+//Größe und Umfang der Bibliothek, nur als globale Build-Option setzen (build_flags / -D),
+//nie im Sketch vor dem Einbinden: z21.cpp wird getrennt übersetzt und sähe eine andere z21Class.
+//Passt die Größe nicht, arbeitet die Bibliothek nicht (getSizeError()).
+#ifndef z21clientMAX
+#define z21clientMAX 30        //Speichergr��e f�r IP-Adressen (max. 255)
+#endif
+#ifndef z21ActTimeIP
 #define z21ActTimeIP 20    //Aktivhaltung einer IP f�r (sec./2)
+#endif
+#ifndef z21IPinterval
 #define z21IPinterval 2000   //interval at milliseconds
+#endif
+#ifndef z21FrameMAX
+#define z21FrameMAX 24	//Speichergröße für eine ausgehende Meldung
+#endif
+//AVR: small stores, the RAM is only 2 KB (ATmega328)
+#ifndef z21ClientIndex
+#if defined(__AVR__)
+#define z21ClientIndex 0	//search the client
+#else
+#define z21ClientIndex (z21clientMAX > 8)	//direct index for client lookup (256 Byte)
+#endif
+#endif
+#ifndef z21LocoMAX
+#if defined(__AVR__)
+#define z21LocoMAX 4	//Speichergröße für Lokzustände
+#else
+#define z21LocoMAX 16	//Speichergröße für Lokzustände
+#endif
+#endif
+#ifndef z21LocoSubMAX
+#if defined(__AVR__)
+#define z21LocoSubMAX 1	//Lok-Abos je Client: LAN_X_LOCO_INFO nur für die zuletzt abgefragte Lok
+#else
+#define z21LocoSubMAX 16	//Lok-Abos je Client
+#endif
+#endif
+#ifndef z21S88MAX
+#if defined(__AVR__)
+#define z21S88MAX 20	//Speichergröße für S88 Module
+#else
+#define z21S88MAX 64	//Speichergröße für S88 Module
+#endif
+#endif
+#ifndef z21LocoNet
+#define z21LocoNet 1	//LocoNet messages
+#endif
+#ifndef z21LNMAX
+#define z21LNMAX 127	//max. length of a LocoNet message
+#endif
+#ifndef z21CAN
+#define z21CAN 1	//CAN detector messages
+#endif
+#ifndef z21ConfStore
+#define z21ConfStore 1	//store Z21 configuration inside EEPROM
+#endif
+
+#if z21clientMAX > 255
+#error "z21clientMAX can't be more then 255"
+#endif
+
+#if defined(z21Stats) && defined(z21StatsHeader)
+#if z21FrameMAX < 21
+#error "z21FrameMAX can't be less then 21 with z21StatsHeader"
+#endif
+#elif z21FrameMAX < 20
+#error "z21FrameMAX can't be less then 20 (LAN_SYSTEMSTATE_DATACHANGED)"
+#endif
+
+#if z21ActTimeIP > 254
+#error "z21ActTimeIP can't be more then 254"
+#endif
+
+#if defined(SERIALDEBUG) && !defined(z21Trace)
+#define z21Trace 32
+#endif
+#if defined(z21Trace)
+#if z21Trace > 255
+#error "z21Trace can't be more then 255"
+#endif
+#ifndef z21TraceTime
+#define z21TraceTime micros	//time stamp of a trace record, e.g. ESP.getCycleCount
+#endif
+#endif
+
+#if defined(z21Stats)
+#define z21StatsMessages 40	//counters per message type, see getStatsMessage()
+#define z21StatsBins 16	//log2 time histogram in us: bin 0 = 0, bin n = 2^(n-1) to 2^n-1, last bin = more
+#define z21StatsFanOut 9	//log2 histogram of the clients of a BC frame, same bins
+#endif
+
+#define z21WheelSize (z21ActTimeIP + 1)	//buckets of the client timeout wheel, one for each interval
+#define z21SlotBytes ((z21clientMAX + 7) / 8)	//one bit for each client slot
+#define z21bcLocalBits 11	//number of local stored BC flags, see z21header.h
+#define z21LocoNone 0xFFFF	//no loco, outside the 14 bit address range
+#if z21LocoNet && (0x04 + z21LNMAX) > z21FrameMAX
+#define z21SendMAX (0x04 + z21LNMAX)	//longest outgoing frame
+#else
+#define z21SendMAX z21FrameMAX
+#endif
+
+//Capture record: time (ms, 4 Byte), client, type, length (2 Byte), little endian, then the data
+#define z21CaptureHeader 8
+#define z21CaptureRX 0	//received datagram
+#define z21CaptureTX 1	//frame send while receive()
+#define z21CaptureTXAPI 2	//frame send by a call of the sketch, like setS88Data()
+
+//Trace events
+#define z21TraceRX 0	//message received
+#define z21TraceTX 1	//frame send to a client
+#define z21TraceBad 2	//message with wrong length or XOR
+#define z21TraceUnknown 3	//unknown message, answered with LAN_X_UNKNOWN_COMMAND
+#define z21TraceLogon 4	//new client, db0 = slot
+#define z21TraceLogoff 5	//client removed (timeout or LAN_LOGOFF), db0 = slot
+#define z21TracePower 6	//track power, db0 = state
+
+//Priority of a message
+#define z21PrioNormal 0
+#define z21PrioHigh 1	//stop and power off
 
 //DCC Speed Steps
 #define DCCSTEP14	0x01
@@ -82,8 +226,60 @@ HwType: #define D_HWT_Z21_OLD 0x00000200 // �schwarze Z21� (Hardware-Variant
 
 struct TypeActIP {
   byte client;    // Byte client
-  byte BCFlag;  //BoadCastFlag - see Z21type.h
-  byte time;  //Zeit
+  unsigned long BCFlag;  //BoadCastFlag - see Z21type.h
+  byte time;  //bucket of the timer wheel + 1, 0 = not active
+  uint16_t loco[z21LocoSubMAX];	//subscribed locos, newest first, z21LocoNone = free
+};
+
+struct TypeLocoState {
+  uint16_t Adr;	//Lokadresse, z21LocoNone = frei
+  byte steps;	//DCCSTEP14, DCCSTEP28, DCCSTEP128
+  byte speed;	//DSSS SSSS
+  byte F[5];	//F0, F4-F1 / F5-F12 / F13-F20 / F21-F28 like LAN_X_LOCO_INFO / F29-F31
+  bool complete;	//set by setLocoStateFull, otherwise only the functions are known
+  bool changed;	//LAN_X_LOCO_INFO not send yet
+};
+
+struct TypeSpan {
+  const uint8_t *data;	//part of a frame
+  size_t length;
+};
+
+struct TypeTrace {
+  unsigned long time;	//z21TraceTime()
+  byte event;	//z21TraceRX, z21TraceTX, ...
+  byte client;
+  byte header;	//LAN header
+  byte xheader;	//X-Header, 0 = no X-Bus message
+  byte db0;	//first data byte
+  uint16_t length;	//of the message
+};
+
+#if defined(z21Stats)
+struct TypeStats {
+  unsigned long rxDatagrams;	//calls of receive()
+  unsigned long rxMessage[z21StatsMessages];	//per message type, see getStatsMessage()
+  unsigned long rxUnknown;	//answered with LAN_X_UNKNOWN_COMMAND
+  unsigned long rxMalformed;	//wrong length or XOR
+  unsigned long txAnswer;	//frames to the client that asked
+  unsigned long txAll;	//frames to all clients in one (client 0)
+  unsigned long txBC[z21bcLocalBits];	//BC frames by the lowest local BC flag, one for each client
+  unsigned long txDropped;	//frames the transport could not send
+  unsigned long txSuperseded;	//waiting state frames replaced by a newer one
+  unsigned long fanOut[z21StatsFanOut];	//clients of a BC frame (log2)
+  unsigned long logon;	//new clients
+  unsigned long logoff;	//timeout or LAN_LOGOFF
+  unsigned long full;	//new clients not stored, all slots in use
+  byte clients;	//active clients
+  unsigned long receiveTime[z21StatsBins];	//duration of receive() (log2 us)
+  unsigned long sendTime[z21StatsBins];	//duration to send a frame to all its clients (log2 us)
+};
+#endif
+
+struct TypeLocoSpeed {
+  uint16_t Adr;	//Lokadresse
+  byte speed;	//DSSS SSSS
+  byte steps;	//14, 28, 128
 };
 
 // library interface description
@@ -91,9 +287,11 @@ class z21Class
 {
   // user-accessible "public" interface
   public:
-	z21Class(void);	//Constuctor
+	z21Class(void) : z21Class(sizeof(z21Class)) {}	//Constuctor, with the size the sketch sees
+	bool getSizeError();	//sketch and library use other size options, the library does nothing
 
 	void receive(uint8_t client, uint8_t *packet);				//Pr�fe auf neue Ethernet Daten
+	void receive(uint8_t client, uint8_t *packet, uint16_t length);	//all messages inside one UDP datagram
 	
 	void setPower(byte state);		//Zustand Gleisspannung Melden
 	byte getPower();		//Zusand Gleisspannung ausgeben
@@ -101,14 +299,19 @@ class z21Class
 	void setCVPOMBYTE (uint16_t CVAdr, uint8_t value);	//POM write byte return
 	
 	void setLocoStateFull (int Adr, byte steps, byte speed, byte F0, byte F1, byte F2, byte F3, bool bc);	//send Loco state 
-	unsigned long getz21BcFlag (byte flag);	//Convert local stored flag back into a Z21 Flag
+	unsigned long getz21BcFlag (unsigned long flag);	//Convert local stored flag back into a Z21 Flag
 	
-	void setS88Data(byte *data, byte modules);	//return state of S88 sensors
+	void setS88Data(byte *data, byte modules);	//return state of S88 sensors, only changed groups
+	void setS88DataFull(byte *data, byte modules);	//return state of all S88 sensors
 
-	void setLNDetector(byte *data, byte DataLen);	//return state from LN detector
-	void setLNMessage(byte *data, byte DataLen, byte bcType, bool TX);	//return LN Message
+#if z21LocoNet
+	void setLNDetector(const byte *data, byte DataLen);	//return state from LN detector
+	void setLNMessage(const byte *data, byte DataLen, byte bcType, bool TX);	//return LN Message
+#endif
 	
+#if z21CAN
 	void setCANDetector(uint16_t NID, uint16_t Adr, uint8_t port, uint8_t typ, uint16_t v1, uint16_t v2); //state from CAN detector
+#endif
 
 
 	void setTrntInfo(uint16_t Adr, bool State); //Return the state of accessory
@@ -119,21 +322,150 @@ class z21Class
 	
 	void sendSystemInfo(byte client, uint16_t maincurrent, uint16_t mainvoltage, uint16_t temp); 	//Send to all clients that request via BC the System Information
 	
+	void tick(unsigned long now);	//client timeout and send waiting frames, now = time of the clock
+	void tick();	//same with the time of the clock
+	void setClock(unsigned long (*clock)(void));	//time source in ms, NULL = millis()
+	void flush();	//send all collected and waiting frames (z21TxBuffer, z21TxRetry)
+	
+	unsigned long getRxMalformed();	//number of rejected messages
+	unsigned long getTxDropped();	//number of frames the transport could not send
+	unsigned long getTxSuperseded();	//number of waiting state frames replaced by a newer one
+#if defined(z21Trace)
+	byte getTrace(TypeTrace *record, byte max);	//take the oldest trace records, return the number
+	unsigned long getTraceLost();	//trace records overwritten before read
+#if defined(ZDebug)
+	void dumpTrace();	//print and empty the trace
+#endif
+#endif
+#if defined(z21Stats)
+	void getStats(TypeStats *stats);	//copy of the counters
+	void clearStats();	//all counters to 0, also getRxMalformed(), getTxDropped() and getTxSuperseded()
+	bool getStatsMessage(byte index, uint16_t *header, byte *xheader, byte *db0);	//message of a rxMessage counter, false = not a known message
+#endif
+	unsigned long getStopLatency();	//stop or power off until answer in micro seconds
+	unsigned long getStopLatencyMax();	//worst stop or power off until answer in micro seconds
+	
+#if defined(z21SpeedQueue)
+	bool pollLocoSpeed(uint16_t *Adr, uint8_t *speed, uint8_t *steps);	//next waiting loco speed command, stop and power off remove all
+#endif
+	
   // library-accessible "private" interface
   private:
+	z21Class(size_t size);	//Constuctor, size = sizeof(z21Class) of the sketch
 
 		//Variables:
 	byte Railpower;				//state of the railpower
-	long z21IPpreviousMillis;        // will store last time of IP decount updated  
+	unsigned long (*Clock)(void);	//time source in ms
+	unsigned long z21IPpreviousMillis;        // will store last time of IP decount updated  
+	byte WheelHead[z21WheelSize];	//first client slot of each bucket, z21clientMAX = empty
+	byte WheelNext[z21clientMAX];	//clients with the same bucket
+	byte WheelPrev[z21clientMAX];
+	byte WheelPos;	//bucket of the current interval
+	byte BCSlots[z21bcLocalBits][z21SlotBytes];	//slots that subscribed each local BC flag
+#if z21ClientIndex
+	byte ClientSlot[256];	//slot of each client, z21clientMAX = not stored
+#endif
+	TypeLocoState LocoState[z21LocoMAX];	//last known state of the locos, last used first
+	byte S88State[z21S88MAX];	//last send state of the S88 modules
+	byte S88Modules;	//number of modules inside S88State
+	byte S88ModulesSend;	//number of modules at the last setS88Data
+#if defined(z21TxRetry)
+	byte TxRetry[z21clientMAX + 1][z21TxRetry][z21FrameMAX];	//frames the transport could not send, last one for all clients
+	byte TxRetryFirst[z21clientMAX + 1];
+	byte TxRetryLen[z21clientMAX + 1];
+#endif
+#if defined(z21TxBuffer)
+	byte TxBuffer[z21clientMAX + 1][z21TxBuffer];	//collected frames for each slot, last one for all clients
+	uint16_t TxBufferLen[z21clientMAX + 1];
+	byte TxOrder[z21clientMAX + 1];	//slots with collected frames, in the order of their first frame
+	uint16_t TxOrderLen;
+#endif
+#if defined(z21SpeedQueue)
+	TypeLocoSpeed SpeedQueue[z21SpeedQueue];	//waiting loco speed commands, oldest first
+	byte SpeedQueueLen;
+#endif
+	unsigned long RxMalformed;	//rejected messages
+	unsigned long TxDropped;	//frames lost because the transport was busy
+	unsigned long TxSuperseded;	//waiting state frames replaced by a newer one
+#if defined(z21Trace)
+	TypeTrace Trace[z21Trace];	//ring of the last events
+	byte TraceFirst;
+	byte TraceLen;
+	unsigned long TraceLost;
+#endif
+#if defined(z21Stats)
+	TypeStats Stats;	//counters, the derived ones are set by getStats()
+#endif
+	unsigned long StopMicros;	//time of the last stop or power off command
+	bool StopPending;	//stop or power off not answered
+#if defined(z21Capture)
+	bool InReceive;	//frames are answers of a received datagram
+#endif
+	unsigned long StopLatency;
+	unsigned long StopLatencyMax;
+#if z21SendMAX > z21FrameMAX
+	byte SendFrame[z21SendMAX];	//frame in one piece without notifyz21EthSendv, up to 131 Byte would be too much for the stack
+#endif
 	TypeActIP ActIP[z21clientMAX];    //Speicherarray f�r IPs
 	
 		//Functions:
-	void EthSend (byte client, unsigned int DataLen, unsigned int Header, byte *dataString, boolean withXOR, byte BC);
-	byte getLocalBcFlag (unsigned long flag);  //Convert Z21 LAN BC flag to local stored flag
+	void receiveMessage(uint8_t client, uint8_t *packet);	//handle a single Z21 message
+	byte getHandler(uint8_t *packet);	//handler of a message, see z21DispatchTable
+	byte getPriority(byte *data, uint16_t DataLen);	//z21PrioNormal or z21PrioHigh
+	byte getPriority(const TypeSpan *span, byte count);	//of a frame in parts
+	byte peekFrame(const TypeSpan *span, byte count, byte *data, byte max);	//first bytes of a frame in parts
+#if defined(z21Trace)
+	void trace(byte event, byte client, byte header, byte xheader, byte db0, uint16_t length);	//add a trace record
+#endif
+	void EthSend (byte client, unsigned int DataLen, unsigned int Header, byte *dataString, boolean withXOR, unsigned long BC, uint16_t LocoAdr = z21LocoNone);
+	void EthSendFrame (byte client, const TypeSpan *span, byte count, unsigned long BC, uint16_t LocoAdr = z21LocoNone);	//send a frame in parts
+	void EthSendTo (byte client, const TypeSpan *span, byte count, byte prio);	//one frame to one client
+	void EthSendDirect (byte client, const TypeSpan *span, byte count, byte prio);	//send without collecting
+	bool EthTransport (byte client, const TypeSpan *span, byte count);	//hand data to the transport
+#if defined(z21Stats)
+	void countTime (unsigned long *bins, unsigned long start);	//add the time since start to a histogram
+	unsigned long getStatsValue (byte page, byte i);	//counter of the LAN query
+#endif
+#if defined(z21Capture)
+	void capture (byte client, byte type, const TypeSpan *span, byte count);	//record for notifyz21Capture
+#endif
+	unsigned long getStateKey (const TypeSpan *span, byte count);	//LAN_X_LOCO_INFO, LAN_X_TURNOUT_INFO, LAN_RMBUS_DATACHANGED, track power
+	bool replaceTx (byte *buf, uint16_t len, const TypeSpan *span, byte count, uint16_t DataLen);	//newer state frame into a buffer
+#if defined(z21TxRetry)
+	bool retryTx (byte pos, byte prio = z21PrioNormal);	//send the waiting frames of a slot, z21PrioHigh = only stop and power off
+	void keepTx (byte pos, const TypeSpan *span, byte count, byte prio);	//frame for the next try
+	void dropRetry (byte pos, unsigned long key);	//remove waiting state frames
+	void removeRetry (byte pos, byte n);	//remove a waiting frame
+#endif
+#if z21LocoNet
+	void EthSendLN (unsigned int Header, const byte *data, byte DataLen, unsigned long BC);	//LN message up to z21LNMAX
+#endif
+#if defined(z21TxBuffer)
+	void flushTx (byte pos);	//send the collected frames of a slot
+	void dropTx (byte pos, unsigned long key);	//remove collected state frames
+	void unorderTx (byte pos);	//slot has no collected frames any more
+	void firstTx (byte pos, const TypeSpan *span, byte count);	//stop or power off in front of the collected frames
+#endif
+	unsigned long getLocalBcFlag (unsigned long flag);  //Convert Z21 LAN BC flag to local stored flag
 	void clearIP (byte pos);		//delete the stored client
+	void ageIP (unsigned long now);	//client timeout
+	void linkIP (byte pos);		//client is active, restart the timeout
+	void unlinkIP (byte pos);		//remove the client from the timer wheel
 	void clearIPSlots();			//delete all stored clients
 	void clearIPSlot(byte client);	//delete a client
-	byte addIPToSlot (byte client, byte BCFlag);	
+	byte findIPSlot(byte client);	//slot of a client, z21clientMAX = not stored
+	unsigned long addIPToSlot (byte client, unsigned long BCFlag);
+	void setBcFlag (byte pos, unsigned long BCFlag);	//change the BC flag of a slot
+	TypeLocoState *getLocoState (uint16_t Adr, bool add);	//stored state of a loco
+	byte setLocoFkt (TypeLocoState *loco, byte type, byte fkt);	//change a stored function
+	void sendLocoInfoChanged ();	//BC the changed locos
+	byte findLocoSub (byte pos, uint16_t Adr);	//subscribed loco of a slot
+	void addLocoSub (byte client, uint16_t Adr);	//subscribe a loco
+#if defined(z21SpeedQueue)
+	bool addLocoSpeed (uint16_t Adr, byte speed, byte steps);	//store a loco speed command
+#endif
+	void sendS88Group (byte client, byte group, byte *data, byte modules, unsigned long BC);	//RMBUS_DATACHANGED
+	void sendLocoInfo (byte client, TypeLocoState *loco, unsigned long BC);	//LAN_X_LOCO_INFO
 
 };
 
@@ -144,6 +476,11 @@ class z21Class
 	extern void notifyz21getSystemInfo(uint8_t client) __attribute__((weak));
 	
 	extern void notifyz21EthSend(uint8_t client, uint8_t *data) __attribute__((weak));
+	//return false when the transport is busy (z21TxBuffer, z21TxRetry keep the data for the next try)
+	extern bool notifyz21EthSendData(uint8_t client, const uint8_t *data, size_t length) __attribute__((weak));	//one or more frames
+	extern bool notifyz21EthSendv(uint8_t client, const TypeSpan *span, uint8_t count) __attribute__((weak));	//one frame in parts: length and header, data, XOR; with z21TxBuffer or z21TxRetry also one part with one or more frames
+
+	extern void notifyz21Capture(const TypeSpan *span, uint8_t count) __attribute__((weak));	//one record: z21CaptureHeader Byte, then the data in parts (z21Capture)
 
 	extern void notifyz21LNdetector(uint8_t typ, uint16_t Adr) __attribute__((weak));
 	extern uint8_t notifyz21LNdispatch(uint8_t Adr2, uint8_t Adr) __attribute__((weak));
@@ -161,7 +498,7 @@ class z21Class
 	extern uint8_t notifyz21AccessoryInfo(uint16_t Adr) __attribute__((weak));
 	extern void notifyz21Accessory(uint16_t Adr, bool state, bool active) __attribute__((weak));
 	extern void notifyz21getLocoState(uint16_t Adr, bool bc) __attribute__((weak));
-	extern void notifyz21LocoFkt(uint16_t Adr, uint8_t type, uint8_t fkt) __attribute__((weak));
+	extern void notifyz21LocoFkt(uint16_t Adr, uint8_t type, uint8_t fkt) __attribute__((weak));	//type: new state 0=AUS, 1=EIN; 2=UM only when the loco state is not known (setLocoStateFull)
 	extern void notifyz21LocoSpeed(uint16_t Adr, uint8_t speed, uint8_t steps) __attribute__((weak));
 	
 	extern void notifyz21S88Data(uint8_t gIndex) __attribute__((weak));	//return last state S88 Data for the Client!